@@ -6,6 +6,30 @@
 #include <cmath>
 #include <algorithm>
 #include <iostream>
+#include <unordered_map>
+#include <list>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <coroutine>
+#include <fstream>
+#include <sstream>
+#if !defined(_WIN32)
+#define PROJECT_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MOTION_X86 1
+#include <immintrin.h>
+#endif
 
 // ─── Layout (سایزها برای خروج از حالت فول اسکرین کوچک شدند) ───────────────────
 static const int WINDOW_W   = 1150;
@@ -25,10 +49,11 @@ static const int BLOCK_GAP  = 8;
 static const SDL_Color COL_MOTION   = {74,  144, 226, 255};
 static const SDL_Color COL_LOOKS    = {153, 102, 255, 255};
 static const SDL_Color COL_EVENTS   = {255, 171, 25,  255};
+static const SDL_Color COL_CONTROL  = {255, 140, 26,  255};
 
 // ─── Enums ────────────────────────────────────────────────────────────────────
-enum BlockCategory { BCAT_EVENT, BCAT_MOTION, BCAT_LOOKS };
-enum BlockType { EVENT_FLAG, CHANGE_X, CHANGE_Y, SET_X, SET_Y, LOOKS_SHOW, LOOKS_HIDE };
+enum BlockCategory { BCAT_EVENT, BCAT_MOTION, BCAT_LOOKS, BCAT_CONTROL };
+enum BlockType { EVENT_FLAG, CHANGE_X, CHANGE_Y, SET_X, SET_Y, LOOKS_SHOW, LOOKS_HIDE, CONTROL_WAIT };
 
 // ─── Structs ──────────────────────────────────────────────────────────────────
 struct Block {
@@ -45,269 +70,3152 @@ struct PaletteHeader {
     int yPos;
 };
 
+// ─── Arena ────────────────────────────────────────────────────────────────────
+// Monotonic arena: allocation bumps a pointer through chunks that are kept
+// across ArenaReset, so freeing everything in it is O(1) and refilling it
+// after a reset allocates nothing. An arena belongs to one thread.
+static const size_t ARENA_CHUNK     = 64 * 1024;          // first chunk; each next one doubles
+static const size_t ARENA_MAX_CHUNK = 16 * 1024 * 1024;   // up to here
+
+struct Arena {
+    std::vector<std::unique_ptr<Uint8[]>> chunks;
+    std::vector<size_t>                   sizes;
+    size_t cur  = 0;   // chunk being filled
+    size_t used = 0;   // bytes taken from it
+    Uint64 allocations  = 0;   // since creation
+    Uint64 bytes        = 0;
+    Uint64 resets       = 0;
+    Uint64 chunkMallocs = 0;   // system allocations behind all of the above
+};
+
+static void* ArenaAlloc(Arena& a, size_t n, size_t align) {
+    a.allocations++;
+    a.bytes += n;
+    for (; a.cur < a.chunks.size(); a.cur++, a.used = 0) {
+        size_t at = (a.used + align - 1) & ~(align - 1);
+        if (at + n <= a.sizes[a.cur]) {
+            a.used = at + n;
+            return a.chunks[a.cur].get() + at;
+        }
+    }
+    size_t size = std::max(n + align, a.sizes.empty() ? ARENA_CHUNK : std::min(a.sizes.back() * 2, ARENA_MAX_CHUNK));
+    a.chunks.emplace_back(new Uint8[size]);
+    a.sizes.push_back(size);
+    a.chunkMallocs++;
+    a.cur = a.chunks.size() - 1;
+    Uint8* base = a.chunks.back().get();
+    size_t at   = (size_t)((-(uintptr_t)base) & (align - 1));
+    a.used = at + n;
+    return base + at;
+}
+
+static void ArenaReset(Arena& a) {
+    a.cur  = 0;
+    a.used = 0;
+    a.resets++;
+}
+
+// Standard allocator over an arena; with no arena it uses the heap. Freeing
+// into an arena does nothing, and the arena travels with moved and swapped
+// containers.
+template <class T>
+struct ArenaAllocator {
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+
+    Arena* arena = nullptr;
+
+    ArenaAllocator() = default;
+    explicit ArenaAllocator(Arena* a) : arena(a) {}
+    template <class U> ArenaAllocator(const ArenaAllocator<U>& o) : arena(o.arena) {}
+
+    T* allocate(size_t n) {
+        if (!arena) return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(ArenaAlloc(*arena, n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t) {
+        if (!arena) ::operator delete(p);
+    }
+    template <class U> bool operator==(const ArenaAllocator<U>& o) const { return arena == o.arena; }
+};
+
+template <class T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+using Script = ArenaVector<Block>;
+
+static Script NewScript(Arena* a) {
+    return Script(ArenaAllocator<Block>(a));
+}
+
+void PrintArenaStats(const char* name, const Arena& a) {
+    size_t reserved = 0;
+    for (size_t s : a.sizes) reserved += s;
+    char buf[200];
+    SDL_snprintf(buf, sizeof(buf), "%s: %llu allocations, %llu KB, %llu resets, %llu chunk mallocs (%llu KB held)\n",
+                 name, (unsigned long long)a.allocations, (unsigned long long)(a.bytes / 1024),
+                 (unsigned long long)a.resets, (unsigned long long)a.chunkMallocs,
+                 (unsigned long long)(reserved / 1024));
+    std::cout << buf;
+}
+
+Arena projectArena;   // scripts of the loaded project, in headless and thumbnail runs
+Arena compileArena;   // the VM's compiled program, rebuilt on every start
+
+// ─── Block Lists ──────────────────────────────────────────────────────────────
+// Editor scripts are doubly-linked lists threaded through one node pool. A
+// handle is a pool index and stays valid until its block is freed, so
+// detaching, inserting and moving a block are O(1) and never move the rest.
+typedef int BlockHandle;
+static const BlockHandle NO_BLOCK = -1;
+
+struct BlockNode {
+    Block       block;
+    BlockHandle prev = NO_BLOCK;
+    BlockHandle next = NO_BLOCK;
+    int         slot = -1;   // in the workspace layout, while laid out
+};
+
+struct BlockPool {
+    std::vector<BlockNode> nodes;
+    BlockHandle freeList = NO_BLOCK;   // through `next`
+    int         live     = 0;
+};
+
+struct BlockList {
+    BlockHandle head = NO_BLOCK;
+    BlockHandle tail = NO_BLOCK;
+    int         size = 0;
+};
+
+BlockPool blockPool;
+
+static Block&      BlockAt(BlockHandle h)   { return blockPool.nodes[h].block; }
+static BlockHandle NextBlock(BlockHandle h) { return blockPool.nodes[h].next; }
+static BlockHandle PrevBlock(BlockHandle h) { return blockPool.nodes[h].prev; }
+
+// A detached node holding b
+static BlockHandle NewBlockNode(const Block& b) {
+    BlockPool&  p = blockPool;
+    BlockHandle h = p.freeList;
+    if (h != NO_BLOCK) p.freeList = p.nodes[h].next;
+    else { h = (BlockHandle)p.nodes.size(); p.nodes.emplace_back(); }
+    p.nodes[h] = {b, NO_BLOCK, NO_BLOCK};
+    p.live++;
+    return h;
+}
+
+// h must be detached
+static void FreeBlockNode(BlockHandle h) {
+    BlockPool& p = blockPool;
+    p.nodes[h].next = p.freeList;
+    p.freeList = h;
+    p.live--;
+}
+
+// Drops every node at once; only valid when no list is kept
+static void ResetBlockPool() {
+    blockPool.nodes.clear();
+    blockPool.freeList = NO_BLOCK;
+    blockPool.live     = 0;
+}
+
+// Links detached node h into l before `before`, or at the end for NO_BLOCK
+static void InsertBlock(BlockList& l, BlockHandle before, BlockHandle h) {
+    BlockNode& n = blockPool.nodes[h];
+    n.next = before;
+    n.prev = before == NO_BLOCK ? l.tail : PrevBlock(before);
+    if (n.prev == NO_BLOCK) l.head = h;
+    else                    blockPool.nodes[n.prev].next = h;
+    if (before == NO_BLOCK) l.tail = h;
+    else                    blockPool.nodes[before].prev = h;
+    l.size++;
+}
+
+static void DetachBlock(BlockList& l, BlockHandle h) {
+    BlockNode& n = blockPool.nodes[h];
+    if (n.prev == NO_BLOCK) l.head = n.next;
+    else                    blockPool.nodes[n.prev].next = n.next;
+    if (n.next == NO_BLOCK) l.tail = n.prev;
+    else                    blockPool.nodes[n.next].prev = n.prev;
+    n.prev = n.next = NO_BLOCK;
+    l.size--;
+}
+
+template <class It>
+static void AppendBlocks(BlockList& l, It first, It last) {
+    for (; first != last; ++first) InsertBlock(l, NO_BLOCK, NewBlockNode(*first));
+}
+
+// Copies l in order into out, replacing its contents
+template <class V>
+static void CopyBlocks(const BlockList& l, V& out) {
+    out.clear();
+    out.reserve(l.size);
+    for (BlockHandle h = l.head; h != NO_BLOCK; h = NextBlock(h)) out.push_back(BlockAt(h));
+}
+
 // ─── Globals ──────────────────────────────────────────────────────────────────
-SDL_Texture* spriteTexture = nullptr;
+std::vector<SDL_Texture*> spriteTextures;   // indexed by sprite texture id
 TTF_Font*    font          = nullptr;
 TTF_Font*    fontSmall     = nullptr;
 
-float spriteX = STAGE_W / 2.0f;
-float spriteY = STAGE_H / 2.0f;
-bool  spriteVisible = true;
+std::vector<Block> palette;
+std::vector<PaletteHeader> catHeaders;
+BlockList workspace;
+
+// Drag
+bool  dragging        = false;
+Block dragBlock       = {};
+int   dragOffX        = 0, dragOffY = 0;
+bool  dragFromPalette = false;
+BlockHandle dragNode   = NO_BLOCK;   // a workspace block being dragged, detached
+
+// Edit
+bool  editingValue = false;
+BlockHandle editingBlock = NO_BLOCK;
+std::string inputBuffer;
+
+// Script, as the editor sees it (derived from the VM's snapshot)
+bool   scriptRunning = false;   // any sprite still has code to run
+int    scriptStep    = 0;       // workspace position of the selected sprite's next block
+Uint32 lastFrameTime = 0;
+
+// VM clock
+Uint32 simClock      = 0;   // SDL_GetTicks() at the last UpdateScript
+Uint32 simAccum      = 0;   // unsimulated time, always < STEP_DELAY after UpdateScript
+static const int STEP_DELAY        = 400;   // one interpreter tick
+static const int MAX_CATCHUP_TICKS = 5;     // beyond this, backlog is dropped
+static const int FRAME_MS          = 16;
+
+// Turbo: run blocks back to back for up to TURBO_BUDGET_MS per frame
+static const double TURBO_BUDGET_MS = 8.0;
+bool   turboMode       = false;
+Uint64 blocksExecuted  = 0;
+Uint64 rateBlocks      = 0;     // blocks and interpreter time since the last rate update
+Uint64 rateCounts      = 0;
+double blocksPerSecond = 0.0;
+
+// ─── Sprites ──────────────────────────────────────────────────────────────────
+// Runtime sprite state as structure-of-arrays: the interpreter walks sprites in
+// index order touching only the hot columns. The table belongs to the VM (the
+// simulation thread, once it runs); the editor draws from a published
+// snapshot and keeps names and scripts in its own SpriteList.
+struct SpriteTable {
+    int count = 0;
+    std::vector<float>  x, y;
+    std::vector<float>  prevX, prevY;   // before the last tick, for interpolation
+    std::vector<Uint64> visible;        // bitset
+    std::vector<int>    pc, codeEnd;    // range of this sprite's code in `program`
+    std::vector<int>    srcEnd;
+    std::vector<Script> scripts;        // the VM's copy, compiled on start
+};
+
+// Editor side. The selected sprite's script is the one in `workspace`.
+struct SpriteList {
+    int count = 0;
+    std::vector<std::string>        name;
+    std::vector<int>                textureId;
+    std::vector<BlockList>          scripts;   // empty for the selected sprite
+};
+
+// Sprite state as published by the VM for drawing
+struct SpriteSnapshot {
+    int count = 0;
+    std::vector<float>  x, y, prevX, prevY;
+    std::vector<Uint64> visible;
+    std::vector<int>    step;         // source block each sprite runs next, -1 when done
+    Uint32 tickTime = 0;              // SDL_GetTicks() of the last tick
+    bool   running  = false;
+    bool   turbo    = false;
+    double blocksPerSecond = 0.0;
+};
+
+SpriteTable    sprites;
+SpriteList     spriteList;
+SpriteSnapshot shown;            // the snapshot on screen
+int  selectedSprite = 0;
+int  runningSprites = 0;
+bool spritesMoving  = false;   // VM: some sprite's prev and current position differ
+bool shownMoving    = false;   // editor: `shown` still has motion to interpolate
+
+static bool TestBit(const std::vector<Uint64>& bits, int i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static bool IsVisible(int i) {
+    return TestBit(sprites.visible, i);
+}
+
+// Sprites the VM has not published yet start out visible
+static bool ShownVisible(int i) {
+    return i >= shown.count || TestBit(shown.visible, i);
+}
+
+static void SetVisible(int i, bool v) {
+    Uint64 bit = 1ull << (i & 63);
+    if (v) sprites.visible[i >> 6] |=  bit;
+    else   sprites.visible[i >> 6] &= ~bit;
+}
+
+static int AddSprite(float x, float y, bool visible) {
+    SpriteTable& s = sprites;
+    int i = s.count++;
+    s.x.push_back(x);      s.y.push_back(y);
+    s.prevX.push_back(x);  s.prevY.push_back(y);
+    if ((size_t)(i >> 6) >= s.visible.size()) s.visible.push_back(0);
+    s.pc.push_back(0);     s.codeEnd.push_back(0);
+    s.srcEnd.push_back(0);
+    s.scripts.emplace_back();
+    SetVisible(i, visible);
+    return i;
+}
+
+static int AddSpriteEntry(const std::string& name, int textureId) {
+    SpriteList& l = spriteList;
+    l.name.push_back(name);
+    l.textureId.push_back(textureId);
+    l.scripts.emplace_back();
+    return l.count++;
+}
+
+static BlockList& ScriptOf(int i) {
+    return i == selectedSprite ? workspace : spriteList.scripts[i];
+}
+
+static SDL_Texture* SpriteTextureFor(int id) {
+    return id >= 0 && id < (int)spriteTextures.size() ? spriteTextures[id] : nullptr;
+}
+
+// ─── Geometry Batch ───────────────────────────────────────────────────────────
+// Quads are gathered per texture and submitted with one SDL_RenderGeometry
+// call each. A null texture draws untextured (vertex-colored) triangles.
+// Batches nest; only the outermost EndBatch submits. Flushing early is always
+// safe: everything queued so far is below anything drawn afterwards.
+struct GeomLayer {
+    SDL_Texture*            tex = nullptr;
+    std::vector<SDL_Vertex> verts;
+    std::vector<int>        indices;
+};
+
+struct RenderBatch {
+    int depth = 0;
+    int used  = 0;                  // layers in use, in order of first texture use
+    std::vector<GeomLayer> layers;  // kept across frames to reuse capacity
+    Uint64 quads         = 0;
+    Uint64 geometryCalls = 0;
+};
+
+RenderBatch renderBatch;
+
+static bool Batching() { return renderBatch.depth > 0; }
+
+static void BeginBatch() { renderBatch.depth++; }
+
+static void FlushBatch(SDL_Renderer* r) {
+    RenderBatch& b = renderBatch;
+    for (int i = 0; i < b.used; i++) {
+        GeomLayer& l = b.layers[i];
+        if (!l.indices.empty()) {
+            SDL_RenderGeometry(r, l.tex, l.verts.data(), (int)l.verts.size(),
+                               l.indices.data(), (int)l.indices.size());
+            b.geometryCalls++;
+        }
+        l.verts.clear();
+        l.indices.clear();
+    }
+    b.used = 0;
+}
+
+static void EndBatch(SDL_Renderer* r) {
+    if (--renderBatch.depth == 0) FlushBatch(r);
+}
+
+static void PushQuad(SDL_Texture* tex, float x0, float y0, float x1, float y1,
+                     float u0, float v0, float u1, float v1, SDL_Color col) {
+    RenderBatch& b = renderBatch;
+    GeomLayer* l = nullptr;
+    for (int i = b.used - 1; i >= 0; i--)
+        if (b.layers[i].tex == tex) { l = &b.layers[i]; break; }
+    if (!l) {
+        if (b.used == (int)b.layers.size()) b.layers.emplace_back();
+        l = &b.layers[b.used++];
+        l->tex = tex;
+    }
+    int base = (int)l->verts.size();
+    l->verts.push_back({{x0, y0}, col, {u0, v0}});
+    l->verts.push_back({{x1, y0}, col, {u1, v0}});
+    l->verts.push_back({{x1, y1}, col, {u1, v1}});
+    l->verts.push_back({{x0, y1}, col, {u0, v1}});
+    for (int k : {0, 1, 2, 0, 2, 3}) l->indices.push_back(base + k);
+    b.quads++;
+}
+
+// src is in texels of a texW x texH texture
+static void PushTexRect(SDL_Texture* tex, int texW, int texH, SDL_Rect src, SDL_Rect dst, SDL_Color col) {
+    float iw = 1.0f / texW, ih = 1.0f / texH;
+    PushQuad(tex, (float)dst.x, (float)dst.y, (float)(dst.x + dst.w), (float)(dst.y + dst.h),
+             src.x * iw, src.y * ih, (src.x + src.w) * iw, (src.y + src.h) * ih, col);
+}
+
+// ─── Glyph Atlas ──────────────────────────────────────────────────────────────
+// Glyphs are rasterized white into one shared texture per font on first use and
+// tinted through vertex colors, so strings are just quads in the render batch.
+static const int    ATLAS_SIZE    = 512;
+static const size_t MAX_TEXT_RUNS = 1024;
+
+struct Glyph {
+    SDL_Rect src;
+};
+
+struct GlyphPos {
+    Uint32 cp;
+    int    x;
+};
+
+struct TextRun {
+    std::vector<GlyphPos> glyphs;
+    int w;
+};
+
+struct GlyphAtlas {
+    TTF_Font*     font     = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture*  tex      = nullptr;
+    int lineH = 0;
+    int penX = 0, penY = 0, rowH = 0;
+    std::unordered_map<Uint32, Glyph>        glyphs;
+    std::unordered_map<std::string, TextRun> runs;   // shaped strings
+};
+
+GlyphAtlas glyphAtlases[2];
+
+static GlyphAtlas* AtlasFor(TTF_Font* f) {
+    if (!f) return nullptr;
+    for (auto& a : glyphAtlases) if (a.font == f) return &a;
+    for (auto& a : glyphAtlases) {
+        if (a.font) continue;
+        a.font  = f;
+        a.lineH = TTF_FontHeight(f);
+        return &a;
+    }
+    return nullptr;
+}
+
+static Uint32 DecodeUTF8(const unsigned char*& p) {
+    Uint32 c = *p++;
+    int extra = 0;
+    if      (c >= 0xF0) { c &= 0x07; extra = 3; }
+    else if (c >= 0xE0) { c &= 0x0F; extra = 2; }
+    else if (c >= 0xC0) { c &= 0x1F; extra = 1; }
+    else if (c >= 0x80) return 0xFFFD;
+    while (extra-- > 0) {
+        if ((*p & 0xC0) != 0x80) return 0xFFFD;
+        c = (c << 6) | (*p++ & 0x3F);
+    }
+    return c;
+}
+
+static const TextRun& ShapeText(GlyphAtlas& a, const char* text) {
+    auto it = a.runs.find(text);
+    if (it != a.runs.end()) return it->second;
+    if (a.runs.size() >= MAX_TEXT_RUNS) a.runs.clear();
+
+    TextRun run{{}, 0};
+    Uint32 prev = 0;
+    const unsigned char* p = (const unsigned char*)text;
+    while (*p) {
+        Uint32 cp = DecodeUTF8(p);
+        int minx, maxx, miny, maxy, adv = 0;
+        if (TTF_GlyphMetrics32(a.font, cp, &minx, &maxx, &miny, &maxy, &adv) != 0) continue;
+        if (prev) run.w += TTF_GetFontKerningSizeGlyphs32(a.font, prev, cp);
+        run.glyphs.push_back({cp, run.w});
+        run.w += adv;
+        prev = cp;
+    }
+    return a.runs.emplace(text, std::move(run)).first->second;
+}
+
+static void ResetAtlasPixels(GlyphAtlas& a) {
+    std::vector<Uint32> zero(ATLAS_SIZE * ATLAS_SIZE, 0);
+    SDL_UpdateTexture(a.tex, nullptr, zero.data(), ATLAS_SIZE * 4);
+    a.glyphs.clear();
+    a.penX = a.penY = a.rowH = 0;
+}
+
+static const Glyph* EnsureGlyph(SDL_Renderer* r, GlyphAtlas& a, Uint32 cp) {
+    if (a.renderer != r) {
+        if (a.tex) SDL_DestroyTexture(a.tex);
+        a.renderer = r;
+        a.tex = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+                                  ATLAS_SIZE, ATLAS_SIZE);
+        if (!a.tex) return nullptr;
+        SDL_SetTextureBlendMode(a.tex, SDL_BLENDMODE_BLEND);
+        ResetAtlasPixels(a);
+    }
+    if (!a.tex) return nullptr;
+    auto it = a.glyphs.find(cp);
+    if (it != a.glyphs.end()) return &it->second;
+
+    Glyph g{{0, 0, 0, 0}};
+    SDL_Surface* surf = TTF_RenderGlyph32_Blended(a.font, cp, {255, 255, 255, 255});
+    SDL_Surface* conv = surf ? SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_ARGB8888, 0) : nullptr;
+    if (surf) SDL_FreeSurface(surf);
+    if (conv && conv->w > 0 && conv->h > 0 && conv->w < ATLAS_SIZE && conv->h < ATLAS_SIZE) {
+        if (a.penX + conv->w > ATLAS_SIZE) { a.penX = 0; a.penY += a.rowH + 1; a.rowH = 0; }
+        if (a.penY + conv->h > ATLAS_SIZE) {
+            // Atlas full: draw what is queued, then start over
+            FlushBatch(r);
+            ResetAtlasPixels(a);
+        }
+        g.src = {a.penX, a.penY, conv->w, conv->h};
+        SDL_UpdateTexture(a.tex, &g.src, conv->pixels, conv->pitch);
+        a.penX += conv->w + 1;
+        a.rowH  = std::max(a.rowH, conv->h);
+    }
+    if (conv) SDL_FreeSurface(conv);
+    return &a.glyphs.emplace(cp, g).first->second;
+}
+
+static void FreeGlyphAtlases() {
+    for (auto& a : glyphAtlases) {
+        if (a.tex) SDL_DestroyTexture(a.tex);
+        a = GlyphAtlas{};
+    }
+}
+
+// ─── Label Cache ──────────────────────────────────────────────────────────────
+// Whole-string textures for labels that rarely change (block names, headers,
+// buttons). Keyed by font, text and color; least recently used entries are
+// evicted once the pixel budget is exceeded.
+static const size_t LABEL_CACHE_BUDGET = 4 * 1024 * 1024;   // bytes of RGBA
+
+struct LabelKey {
+    TTF_Font*   font;
+    std::string text;
+    Uint32      rgba;
+    bool operator==(const LabelKey& o) const {
+        return font == o.font && rgba == o.rgba && text == o.text;
+    }
+};
+
+struct LabelKeyHash {
+    size_t operator()(const LabelKey& k) const {
+        size_t h = std::hash<std::string>()(k.text);
+        h ^= std::hash<const void*>()(k.font) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        h ^= std::hash<Uint32>()(k.rgba)      + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+struct LabelEntry {
+    LabelKey     key;
+    SDL_Texture* tex;
+    int w, h;
+};
+
+struct LabelCache {
+    SDL_Renderer* renderer = nullptr;
+    std::list<LabelEntry> lru;   // front = most recently used
+    std::unordered_map<LabelKey, std::list<LabelEntry>::iterator, LabelKeyHash> index;
+    size_t bytes     = 0;
+    Uint64 hits      = 0;
+    Uint64 misses    = 0;
+    Uint64 evictions = 0;
+};
+
+LabelCache labelCache;
+
+static void ClearLabelCache() {
+    for (auto& e : labelCache.lru) SDL_DestroyTexture(e.tex);
+    labelCache.lru.clear();
+    labelCache.index.clear();
+    labelCache.bytes = 0;
+}
+
+static const LabelEntry* GetLabel(SDL_Renderer* r, TTF_Font* f, const char* text, SDL_Color col) {
+    LabelCache& c = labelCache;
+    if (c.renderer != r) { ClearLabelCache(); c.renderer = r; }
+
+    LabelKey key{f, text, (Uint32)col.r << 24 | (Uint32)col.g << 16 | (Uint32)col.b << 8 | col.a};
+    auto it = c.index.find(key);
+    if (it != c.index.end()) {
+        c.hits++;
+        c.lru.splice(c.lru.begin(), c.lru, it->second);
+        return &*it->second;
+    }
+    c.misses++;
+
+    SDL_Surface* surf = TTF_RenderUTF8_Blended(f, text, col);
+    if (!surf) return nullptr;
+    SDL_Texture* tex = SDL_CreateTextureFromSurface(r, surf);
+    int w = surf->w, h = surf->h;
+    SDL_FreeSurface(surf);
+    if (!tex) return nullptr;
+
+    c.bytes += (size_t)w * h * 4;
+    if (c.bytes > LABEL_CACHE_BUDGET) FlushBatch(r);   // queued quads may use evicted textures
+    while (c.bytes > LABEL_CACHE_BUDGET && !c.lru.empty()) {
+        LabelEntry& old = c.lru.back();
+        c.bytes -= (size_t)old.w * old.h * 4;
+        SDL_DestroyTexture(old.tex);
+        c.index.erase(old.key);
+        c.lru.pop_back();
+        c.evictions++;
+    }
+    c.lru.push_front({key, tex, w, h});
+    c.index.emplace(std::move(key), c.lru.begin());
+    return &c.lru.front();
+}
+
+// ─── Shape Cache ──────────────────────────────────────────────────────────────
+// Circle masks are rasterized once per radius (white, alpha = coverage) into a
+// shared texture and tinted at draw time, replacing one line per scanline.
+static const int SHAPE_ATLAS_SIZE = 256;
+
+struct ShapeCache {
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture*  tex      = nullptr;
+    int penX = 0, penY = 0, rowH = 0;
+    std::unordered_map<int, SDL_Rect> circles;   // radius -> src rect
+};
+
+ShapeCache shapeCache;
+
+static void FreeShapeCache() {
+    if (shapeCache.tex) SDL_DestroyTexture(shapeCache.tex);
+    shapeCache = ShapeCache{};
+}
+
+// Returns nullptr when the mask can't be cached; callers fall back to scanlines.
+static const SDL_Rect* CircleMask(SDL_Renderer* r, int radius) {
+    ShapeCache& c = shapeCache;
+    if (c.renderer != r) {
+        FreeShapeCache();
+        c.renderer = r;
+        c.tex = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+                                  SHAPE_ATLAS_SIZE, SHAPE_ATLAS_SIZE);
+        if (c.tex) SDL_SetTextureBlendMode(c.tex, SDL_BLENDMODE_BLEND);
+    }
+    if (!c.tex || radius < 0) return nullptr;
+    auto it = c.circles.find(radius);
+    if (it != c.circles.end()) return &it->second;
+
+    int d = 2 * radius + 1;
+    if (c.penX + d > SHAPE_ATLAS_SIZE) { c.penX = 0; c.penY += c.rowH + 1; c.rowH = 0; }
+    if (d > SHAPE_ATLAS_SIZE || c.penY + d > SHAPE_ATLAS_SIZE) return nullptr;
+
+    // Same coverage as the scanline fill so cached and uncached shapes match
+    std::vector<Uint32> px(d * d, 0x00FFFFFF);
+    for (int dy = -radius; dy <= radius; dy++) {
+        int dx = (int)std::sqrt((double)(radius*radius - dy*dy));
+        for (int x = radius - dx; x <= radius + dx; x++) px[(dy + radius) * d + x] = 0xFFFFFFFF;
+    }
+    SDL_Rect src{c.penX, c.penY, d, d};
+    SDL_UpdateTexture(c.tex, &src, px.data(), d * 4);
+    c.penX += d + 1;
+    c.rowH  = std::max(c.rowH, d);
+    return &c.circles.emplace(radius, src).first->second;
+}
+
+static void TintShapes(SDL_Color col) {
+    SDL_SetTextureColorMod(shapeCache.tex, col.r, col.g, col.b);
+    SDL_SetTextureAlphaMod(shapeCache.tex, col.a);
+}
+
+// ─── Draw Helpers ─────────────────────────────────────────────────────────────
+// Solid fills sample the 1x1 white mask so chrome shares the shape texture
+static bool SolidTexel(SDL_Renderer* r, SDL_Rect& src) {
+    const SDL_Rect* m = CircleMask(r, 0);
+    if (!m) return false;
+    src = *m;
+    return true;
+}
+
+static void FillRect(SDL_Renderer* r, SDL_Rect rc, SDL_Color col) {
+    SDL_Rect texel;
+    if (Batching() && SolidTexel(r, texel)) {
+        PushTexRect(shapeCache.tex, SHAPE_ATLAS_SIZE, SHAPE_ATLAS_SIZE, texel, rc, col);
+        return;
+    }
+    SDL_SetRenderDrawColor(r, col.r, col.g, col.b, col.a);
+    SDL_RenderFillRect(r, &rc);
+}
+
+static void OutlineRect(SDL_Renderer* r, SDL_Rect rc, SDL_Color col) {
+    if (!Batching()) {
+        SDL_SetRenderDrawColor(r, col.r, col.g, col.b, col.a);
+        SDL_RenderDrawRect(r, &rc);
+        return;
+    }
+    FillRect(r, {rc.x, rc.y, rc.w, 1}, col);
+    FillRect(r, {rc.x, rc.y + rc.h - 1, rc.w, 1}, col);
+    FillRect(r, {rc.x, rc.y + 1, 1, rc.h - 2}, col);
+    FillRect(r, {rc.x + rc.w - 1, rc.y + 1, 1, rc.h - 2}, col);
+}
+
+static void CopyShape(SDL_Renderer* r, const SDL_Rect& src, const SDL_Rect& dst, SDL_Color col) {
+    if (Batching()) {
+        PushTexRect(shapeCache.tex, SHAPE_ATLAS_SIZE, SHAPE_ATLAS_SIZE, src, dst, col);
+        return;
+    }
+    TintShapes(col);
+    SDL_RenderCopy(r, shapeCache.tex, &src, &dst);
+}
+
+static void FillCircle(SDL_Renderer* r, int cx, int cy, int radius) {
+    SDL_Color col;
+    SDL_GetRenderDrawColor(r, &col.r, &col.g, &col.b, &col.a);
+    if (const SDL_Rect* src = CircleMask(r, radius)) {
+        CopyShape(r, *src, {cx - radius, cy - radius, src->w, src->h}, col);
+        return;
+    }
+    for (int dy = -radius; dy <= radius; dy++) {
+        int dx = (int)std::sqrt((double)(radius*radius - dy*dy));
+        SDL_RenderDrawLine(r, cx - dx, cy + dy, cx + dx, cy + dy);
+    }
+}
+
+static void DrawRoundRect(SDL_Renderer* r, SDL_Rect rect, SDL_Color col, int radius = 6) {
+    SDL_SetRenderDrawColor(r, col.r, col.g, col.b, col.a);
+    FillRect(r, {rect.x + radius, rect.y, rect.w - 2*radius, rect.h}, col);
+    FillRect(r, {rect.x, rect.y + radius, rect.w, rect.h - 2*radius}, col);
+
+    const SDL_Rect* m = CircleMask(r, radius);
+    if (!m) {
+        FillCircle(r, rect.x + radius,           rect.y + radius,           radius);
+        FillCircle(r, rect.x + rect.w - radius,  rect.y + radius,           radius);
+        FillCircle(r, rect.x + radius,           rect.y + rect.h - radius,  radius);
+        FillCircle(r, rect.x + rect.w - radius,  rect.y + rect.h - radius,  radius);
+        return;
+    }
+    // One quadrant of the cached circle per corner
+    int q = radius + 1;
+    int l = rect.x, t = rect.y;
+    int rr = rect.x + rect.w - radius, bb = rect.y + rect.h - radius;
+    CopyShape(r, {m->x,          m->y,          q, q}, {l,  t,  q, q}, col);
+    CopyShape(r, {m->x + radius, m->y,          q, q}, {rr, t,  q, q}, col);
+    CopyShape(r, {m->x,          m->y + radius, q, q}, {l,  bb, q, q}, col);
+    CopyShape(r, {m->x + radius, m->y + radius, q, q}, {rr, bb, q, q}, col);
+}
+
+static void DrawText(SDL_Renderer* r, TTF_Font* f, const char* text, int x, int y, SDL_Color col) {
+    GlyphAtlas* a = AtlasFor(f);
+    if (!a) return;
+    const TextRun& run = ShapeText(*a, text);
+    BeginBatch();
+    for (const auto& gp : run.glyphs) {
+        const Glyph* g = EnsureGlyph(r, *a, gp.cp);
+        if (!g || g->src.w == 0) continue;
+        PushTexRect(a->tex, ATLAS_SIZE, ATLAS_SIZE, g->src, {x + gp.x, y, g->src.w, g->src.h}, col);
+    }
+    EndBatch(r);
+}
+
+// Static strings go through the label cache; use DrawText for strings that
+// change every frame so they don't churn it.
+static void DrawLabel(SDL_Renderer* r, TTF_Font* f, const char* text, int x, int y, SDL_Color col) {
+    if (!f || !*text) return;
+    const LabelEntry* e = GetLabel(r, f, text, col);
+    if (!e) return;
+    SDL_Rect dst{x, y, e->w, e->h};
+    if (Batching()) PushTexRect(e->tex, e->w, e->h, {0, 0, e->w, e->h}, dst, {255, 255, 255, 255});
+    else            SDL_RenderCopy(r, e->tex, nullptr, &dst);
+}
+
+static int TextW(TTF_Font* f, const char* text) {
+    GlyphAtlas* a = AtlasFor(f);
+    return a ? ShapeText(*a, text).w : 0;
+}
+
+static int TextH(TTF_Font* f) {
+    GlyphAtlas* a = AtlasFor(f);
+    return a ? a->lineH : 14;
+}
+
+static SDL_Rect DrawValuePill(SDL_Renderer* r, int rx, int ry, int rw, int rh,
+                               int value, bool editing, const std::string& buf) {
+    const int PW = 46, PH = 22;
+    int px = rx + rw - PW - 8;
+    int py = ry + (rh - PH) / 2;
+    DrawRoundRect(r, {px, py, PW, PH}, {255,255,255,240}, 10);
+    OutlineRect(r, {px, py, PW, PH}, {0, 0, 0, 60});
+
+    std::string display = editing ? buf + "|" : std::to_string(value);
+    SDL_Color tc{30,30,30,255};
+    int tw = TextW(fontSmall, display.c_str());
+    if (editing) DrawText(r, fontSmall, display.c_str(), px + (PW - tw)/2, py + 3, tc);
+    else         DrawLabel(r, fontSmall, display.c_str(), px + (PW - tw)/2, py + 3, tc);
+    return {px, py, PW, PH};
+}
+
+static void DrawHatNotch(SDL_Renderer* r, SDL_Rect br, SDL_Color col) {
+    SDL_Rect bump{br.x + 16, br.y - 12, 50, 16};
+    DrawRoundRect(r, bump, {col.r, col.g, col.b, 255}, 6);
+}
+
+// Blocks with an editable number
+static bool HasValue(BlockType t) {
+    return t == CHANGE_X || t == CHANGE_Y || t == SET_X || t == SET_Y || t == CONTROL_WAIT;
+}
+
+static void DrawBlock(SDL_Renderer* r, const Block& b, bool highlight,
+                       bool isEditing, const std::string& buf) {
+    SDL_Color c = b.color;
+    if (highlight) {
+        c.r = (Uint8)std::min(255, (int)c.r + 50);
+        c.g = (Uint8)std::min(255, (int)c.g + 50);
+        c.b = (Uint8)std::min(255, (int)c.b + 50);
+    }
+    if (b.isHat) DrawHatNotch(r, b.rect, c);
+    DrawRoundRect(r, b.rect, c, 6);
+    OutlineRect(r, {b.rect.x+2, b.rect.y+2, b.rect.w, b.rect.h}, {0, 0, 0, 50});
+
+    SDL_Color textCol{255, 255, 255, 255};
+    const char* label = "";
+    switch (b.type) {
+        case EVENT_FLAG: label = "When Flag Clicked"; break;
+        case CHANGE_X:   label = "Change X by";       break;
+        case CHANGE_Y:   label = "Change Y by";       break;
+        case SET_X:      label = "Set X to";          break;
+        case SET_Y:      label = "Set Y to";          break;
+        case LOOKS_SHOW: label = "Show";              break;
+        case LOOKS_HIDE: label = "Hide";              break;
+        case CONTROL_WAIT: label = "Wait steps";      break;
+    }
+    int th = TextH(font);
+    int lx = b.rect.x + 12;
+    int ly = b.rect.y + (b.rect.h - th) / 2;
+    DrawLabel(r, font, label, lx, ly, textCol);
+
+    if (HasValue(b.type)) {
+        DrawValuePill(r, b.rect.x, b.rect.y, b.rect.w, b.rect.h, b.steps, isEditing, buf);
+    }
+}
+
+// ─── Damage Tracking ──────────────────────────────────────────────────────────
+// State changes mark window regions dirty; Render redraws only the panels they
+// touch, clipped to the damage, into a persistent backbuffer. With no damage
+// nothing is drawn or presented at all.
+static const SDL_Rect WINDOW_RECT{0, 0, WINDOW_W, WINDOW_H};
+static const size_t   MAX_DAMAGE_RECTS = 64;
+
+struct Damage {
+    std::vector<SDL_Rect> rects;
+    bool present = true;   // re-present the backbuffer (overlay moved, window exposed)
+};
+
+Damage damage{{WINDOW_RECT}, true};
+
+static void MarkDirty(SDL_Rect rc) {
+    SDL_Rect clipped;
+    if (!SDL_IntersectRect(&rc, &WINDOW_RECT, &clipped)) return;
+    if (damage.rects.size() >= MAX_DAMAGE_RECTS) damage.rects.assign(1, WINDOW_RECT);
+    else damage.rects.push_back(clipped);
+    damage.present = true;
+}
+
+static void MarkAllDirty() {
+    damage.rects.assign(1, WINDOW_RECT);
+    damage.present = true;
+}
+
+// Union of the damage that falls inside area
+static bool DamageIn(const SDL_Rect& area, SDL_Rect& out) {
+    bool any = false;
+    for (const auto& d : damage.rects) {
+        SDL_Rect part;
+        if (!SDL_IntersectRect(&d, &area, &part)) continue;
+        if (any) SDL_UnionRect(&out, &part, &out);
+        else     out = part;
+        any = true;
+    }
+    return any;
+}
+
+static bool     WorkspaceRect(BlockHandle h, SDL_Rect& out);
+static SDL_Rect ViewToScreen(SDL_Rect v);
+
+// Block footprint including the hat notch above and the shadow below-right
+static void MarkBlockDirty(BlockHandle h) {
+    SDL_Rect rc;
+    if (!WorkspaceRect(h, rc)) return;
+    MarkDirty(ViewToScreen({rc.x, rc.y - 12, rc.w + 2, rc.h + 14}));
+}
+
+static const int SPRITE_PANEL_Y = STAGE_Y + STAGE_H + 95;
+static const int SPRITE_ROW_H   = 28;
+static const SDL_Rect SPRITE_LIST_RECT{STAGE_X, SPRITE_PANEL_Y + 36, STAGE_W, WINDOW_H - SPRITE_PANEL_Y - 36};
+
+// Info bar text and the visibility boxes in the sprite list
+static void MarkSpriteInfoDirty() {
+    MarkDirty({STAGE_X, STAGE_Y + STAGE_H + 5, STAGE_W, 35});
+    MarkDirty(SPRITE_LIST_RECT);
+}
+
+static void GrowBox(SDL_Rect& box, bool& any, float x, float y) {
+    SDL_Rect rc{STAGE_X + (int)x - 35, STAGE_Y + (int)y - 35, 70, 70};
+    if (any) SDL_UnionRect(&box, &rc, &box);
+    else     box = rc;
+    any = true;
+}
+
+// Everything the interpolated sprites can cover between prev and current
+static void MarkSpritePathsDirty() {
+    if (!shownMoving) return;
+    const SpriteSnapshot& s = shown;
+    SDL_Rect box{};
+    bool any = false;
+    for (int i = 0; i < s.count; i++) {
+        if (s.prevX[i] == s.x[i] && s.prevY[i] == s.y[i]) continue;
+        GrowBox(box, any, s.prevX[i], s.prevY[i]);
+        GrowBox(box, any, s.x[i],     s.y[i]);
+    }
+    if (any) MarkDirty(box);
+}
+
+// ─── Engine (All blocks visible at once) ──────────────────────────────────────
+// A block of type t with its category, colour and shape; rect is left to layout
+static Block MakeBlock(BlockType t, int steps) {
+    Block b{};
+    b.type  = t;
+    b.steps = steps;
+    switch (t) {
+        case EVENT_FLAG:   b.category = BCAT_EVENT;   b.color = COL_EVENTS;  b.isHat = true; break;
+        case LOOKS_SHOW:
+        case LOOKS_HIDE:   b.category = BCAT_LOOKS;   b.color = COL_LOOKS;   break;
+        case CONTROL_WAIT: b.category = BCAT_CONTROL; b.color = COL_CONTROL; break;
+        default:           b.category = BCAT_MOTION;  b.color = COL_MOTION;  break;
+    }
+    return b;
+}
+
+void BuildPalette() {
+    palette.clear();
+    catHeaders.clear();
+    
+    int x = 25;
+    int y = 20;
+
+    auto addHeader = [&](std::string name) {
+        catHeaders.push_back({name, y});
+        y += 35; 
+    };
+
+    auto mk = [&](BlockType t, int defaultVal) {
+        Block b  = MakeBlock(t, defaultVal);
+        bool hat = b.isHat;
+        b.rect   = {x, y, BLOCK_W, hat ? BLOCK_H + 12 : BLOCK_H};
+        if (hat) b.rect.y += 14;
+        palette.push_back(b);
+        y += b.rect.h + BLOCK_GAP + (hat ? 14 : 0);
+    };
+
+    // 1. Events
+    addHeader("Events");
+    mk(EVENT_FLAG, 0);
+    y += 15;
+
+    // 2. Motion
+    addHeader("Motion");
+    mk(CHANGE_X, 10);
+    mk(CHANGE_Y, 10);
+    mk(SET_X,    0);
+    mk(SET_Y,    0);
+    y += 15;
+
+    // 3. Looks
+    addHeader("Looks");
+    mk(LOOKS_SHOW, 0);
+    mk(LOOKS_HIDE, 0);
+    y += 15;
+
+    // 4. Control
+    addHeader("Control");
+    mk(CONTROL_WAIT, 2);
+}
+
+// ─── Workspace Layout ─────────────────────────────────────────────────────────
+// Workspace blocks sit in sparse slots that keep list order. Two Fenwick
+// trees over the slots hold each block's vertical extent and a 1 per block,
+// so a block's y, the block under a y and the block at a position are all
+// O(log n), and inserting or removing a block only touches its own slot; the
+// blocks below move without being visited. An insert with no free slot
+// between its neighbours respreads the smallest aligned window around it that
+// is sparse enough (a packed memory array), and a half-full array doubles.
+static const int WORKSPACE_TOP     = 60;
+static const int MIN_LAYOUT_LEVELS = 6;
+
+struct WorkspaceLayout {
+    int levels = 0;                     // 1 << levels slots
+    std::vector<int>         extent;    // Fenwick, 1-based: pixels per slot
+    std::vector<int>         count;     // Fenwick, 1-based: blocks per slot
+    std::vector<BlockHandle> block;     // slot -> block, NO_BLOCK when empty
+    std::vector<BlockHandle> scratch;   // respread buffer
+};
+
+WorkspaceLayout layout;
+
+static void FenwickAdd(std::vector<int>& t, int slot, int d) {
+    for (int i = slot + 1; i < (int)t.size(); i += i & -i) t[i] += d;
+}
+
+// Sum over slots [0, slot)
+static int FenwickSum(const std::vector<int>& t, int slot) {
+    int r = 0;
+    for (int i = slot; i > 0; i -= i & -i) r += t[i];
+    return r;
+}
+
+// First slot whose running sum exceeds target; the slot count if none does
+static int FenwickFind(const std::vector<int>& t, int target) {
+    int pos = 0;
+    for (int step = (int)t.size() - 1; step > 0; step >>= 1)
+        if (pos + step < (int)t.size() && t[pos + step] <= target) {
+            pos += step;
+            target -= t[pos];
+        }
+    return pos;
+}
+
+// Pixels a block takes in the column: hat notch, body and gap
+static int BlockExtent(const Block& b) {
+    return (b.isHat ? 14 + BLOCK_H + 12 : BLOCK_H) + BLOCK_GAP;
+}
+
+// The block's body when its band starts at top, in a column whose left is left
+static SDL_Rect BlockRectAt(const Block& b, int left, int top) {
+    return {left + 20, top + (b.isHat ? 14 : 0), BLOCK_W + 20, b.isHat ? BLOCK_H + 12 : BLOCK_H};
+}
+
+static void OccupySlot(BlockHandle h, int slot) {
+    layout.block[slot] = h;
+    blockPool.nodes[h].slot = slot;
+    FenwickAdd(layout.extent, slot, BlockExtent(BlockAt(h)));
+    FenwickAdd(layout.count,  slot, 1);
+}
+
+static void VacateSlot(int slot) {
+    BlockHandle h = layout.block[slot];
+    layout.block[slot] = NO_BLOCK;
+    FenwickAdd(layout.extent, slot, -BlockExtent(BlockAt(h)));
+    FenwickAdd(layout.count,  slot, -1);
+}
+
+static bool InLayout(BlockHandle h) {
+    int s = h == NO_BLOCK ? -1 : blockPool.nodes[h].slot;
+    return s >= 0 && s < (int)layout.block.size() && layout.block[s] == h;
+}
+
+// Lays the whole workspace out again, evenly spread at a quarter load
+void LayoutWorkspace() {
+    WorkspaceLayout& L = layout;
+    int n = workspace.size;
+    L.levels = MIN_LAYOUT_LEVELS;
+    while ((1 << L.levels) < 4 * n) L.levels++;
+    int cap = 1 << L.levels;
+    L.block.assign(cap, NO_BLOCK);
+    L.extent.assign(cap + 1, 0);
+    L.count.assign(cap + 1, 0);
+    int j = 0;
+    for (BlockHandle h = workspace.head; h != NO_BLOCK; h = NextBlock(h), j++) {
+        int s = (int)((long long)j * cap / n);
+        L.block[s] = h;
+        blockPool.nodes[h].slot = s;
+        L.extent[s + 1] = BlockExtent(BlockAt(h));
+        L.count[s + 1]  = 1;
+    }
+    for (int i = 1; i <= cap; i++) {
+        int up = i + (i & -i);
+        if (up > cap) continue;
+        L.extent[up] += L.extent[i];
+        L.count[up]  += L.count[i];
+    }
+}
+
+// Spreads the blocks in slots [lo, lo + size) evenly over them, with h
+// placed after the block in slot `after`, or first when after < lo. The
+// window is aligned to its power-of-two size, so the Fenwick nodes inside it
+// cover only its own slots and are rebuilt in O(size); the nodes above see
+// the window grow by h alone.
+static void RespreadSlots(int lo, int size, BlockHandle h, int after) {
+    WorkspaceLayout& L = layout;
+    std::vector<BlockHandle>& tmp = L.scratch;
+    tmp.clear();
+    if (after < lo) tmp.push_back(h);
+    for (int s = lo; s < lo + size; s++) {
+        if (L.block[s] == NO_BLOCK) continue;
+        tmp.push_back(L.block[s]);
+        L.block[s] = NO_BLOCK;
+        if (s == after) tmp.push_back(h);
+    }
+    for (int j = 0, k = (int)tmp.size(); j < k; j++) {
+        int s = lo + (int)((long long)j * size / k);
+        L.block[s] = tmp[j];
+        blockPool.nodes[tmp[j]].slot = s;
+    }
+    for (int i = lo + 1; i < lo + size; i++) {
+        BlockHandle b = L.block[i - 1];
+        L.extent[i] = b == NO_BLOCK ? 0 : BlockExtent(BlockAt(b));
+        L.count[i]  = b == NO_BLOCK ? 0 : 1;
+    }
+    for (int i = lo + 1; i < lo + size; i++) {
+        int up = i + (i & -i);
+        if (up >= lo + size) continue;
+        L.extent[up] += L.extent[i];
+        L.count[up]  += L.count[i];
+    }
+    int grow = BlockExtent(BlockAt(h));
+    for (int i = lo + size; i < (int)L.extent.size(); i += i & -i) {
+        L.extent[i] += grow;
+        L.count[i]  += 1;
+    }
+}
+
+// Gives h, just linked into the workspace, a slot between its neighbours
+static void LayoutInsert(BlockHandle h) {
+    WorkspaceLayout& L = layout;
+    if (L.block.empty()) { LayoutWorkspace(); return; }
+    int cap = 1 << L.levels;
+    BlockHandle prev = PrevBlock(h), next = NextBlock(h);
+    int a = prev != NO_BLOCK ? blockPool.nodes[prev].slot : -1;
+    int b = next != NO_BLOCK ? blockPool.nodes[next].slot : cap;
+    if (b - a > 1) { OccupySlot(h, a + (b - a) / 2); return; }
+    // Allowed load falls from 1 for the smallest window to 1/2 for all slots
+    int pivot = a >= 0 ? a : b;
+    for (int lv = 1; lv <= L.levels; lv++) {
+        int size = 1 << lv, lo = pivot & ~(size - 1);
+        int load = FenwickSum(L.count, lo + size) - FenwickSum(L.count, lo) + 1;
+        if (2 * L.levels * load <= size * (2 * L.levels - lv)) {
+            RespreadSlots(lo, size, h, a);
+            return;
+        }
+    }
+    LayoutWorkspace();
+}
+
+static void LayoutRemove(BlockHandle h) {
+    if (InLayout(h)) VacateSlot(blockPool.nodes[h].slot);
+}
+
+static void WorkspaceInsert(BlockHandle before, BlockHandle h) {
+    InsertBlock(workspace, before, h);
+    LayoutInsert(h);
+}
+
+static void WorkspaceDetach(BlockHandle h) {
+    LayoutRemove(h);
+    DetachBlock(workspace, h);
+}
+
+// ─── Workspace View ───────────────────────────────────────────────────────────
+// The scripts area scrolls and zooms over the column. Blocks are drawn at the
+// renderer's scale in view units, one per layout pixel (screen = view * zoom),
+// and only those inside the clip are visited: the extent tree finds the block
+// under its top edge and drawing stops past its bottom.
+static const int   SCRIPTS_HEADER_H = 40;
+static const int   SCROLL_STEP      = 40;      // layout pixels per wheel notch
+static const float ZOOM_STEP        = 1.25f;   // per ctrl+wheel notch
+static const int   MIN_ZOOM_LEVEL   = -3;
+static const int   MAX_ZOOM_LEVEL   = 3;
+static const SDL_Rect SCRIPTS_BODY_RECT{SCRIPTS_X, SCRIPTS_HEADER_H, SCRIPTS_W, WINDOW_H - SCRIPTS_HEADER_H};
+
+struct WorkspaceView {
+    int   scroll    = 0;   // layout pixels scrolled past the top of the column
+    int   zoomLevel = 0;   // zoom = ZOOM_STEP ^ zoomLevel
+    float zoom      = 1;
+};
+
+WorkspaceView view;
+
+// View position of the column's top-left corner
+static SDL_Point ViewOrigin() {
+    return {(int)std::floor(SCRIPTS_X / view.zoom), (int)std::floor(WORKSPACE_TOP / view.zoom) - view.scroll};
+}
+
+static SDL_Point ScreenToView(int x, int y) {
+    return {(int)std::floor(x / view.zoom), (int)std::floor(y / view.zoom)};
+}
+
+// Pixels v covers, and at least what SDL's scaled clip lets through for v
+static SDL_Rect ViewToScreen(SDL_Rect v) {
+    float z = view.zoom;
+    int x0 = (int)std::floor(v.x * z), y0 = (int)std::floor(v.y * z);
+    int w  = std::max((int)std::ceil((v.x + v.w) * z) - x0, (int)std::ceil(v.w * z));
+    int h  = std::max((int)std::ceil((v.y + v.h) * z) - y0, (int)std::ceil(v.h * z));
+    return {x0, y0, w, h};
+}
+
+// Smallest view rect covering screen rect s
+static SDL_Rect CoverInView(SDL_Rect s) {
+    SDL_Point a = ScreenToView(s.x, s.y);
+    int x1 = (int)std::ceil((s.x + s.w) / view.zoom), y1 = (int)std::ceil((s.y + s.h) / view.zoom);
+    return {a.x, a.y, x1 - a.x, y1 - a.y};
+}
+
+// View rect drawn inside screen rect s; a column short on the right for rounding
+static SDL_Rect InsideInView(SDL_Rect s) {
+    int x0 = (int)std::ceil(s.x / view.zoom), y0 = (int)std::ceil(s.y / view.zoom);
+    SDL_Point b = ScreenToView(s.x + s.w, s.y + s.h);
+    return {x0, y0, b.x - x0 - 1, b.y - y0};
+}
+
+// Where h is drawn, in view units; false if h isn't laid out
+static bool WorkspaceRect(BlockHandle h, SDL_Rect& out) {
+    if (!InLayout(h)) return false;
+    SDL_Point o = ViewOrigin();
+    out = BlockRectAt(BlockAt(h), o.x, o.y + FenwickSum(layout.extent, blockPool.nodes[h].slot));
+    return true;
+}
+
+// The block whose band (notch, body and gap) covers view y, if any
+static BlockHandle WorkspaceBlockAtY(int y) {
+    int offset = y - ViewOrigin().y;
+    if (offset < 0 || layout.block.empty()) return NO_BLOCK;
+    int s = FenwickFind(layout.extent, offset);
+    return s < (int)layout.block.size() ? layout.block[s] : NO_BLOCK;
+}
+
+// Furthest scroll; keeps a drop target below the last block
+static int MaxScroll() {
+    int total = layout.block.empty() ? 0 : FenwickSum(layout.extent, (int)layout.block.size());
+    int viewH = (int)((WINDOW_H - WORKSPACE_TOP) / view.zoom);
+    return std::max(0, total + WORKSPACE_TOP - viewH);
+}
+
+static void ScrollWorkspace(int scroll) {
+    scroll = std::max(0, std::min(MaxScroll(), scroll));
+    if (scroll == view.scroll) return;
+    view.scroll = scroll;
+    MarkDirty(SCRIPTS_BODY_RECT);
+}
+
+// Zooms keeping the layout row under screen y in place
+static void ZoomWorkspace(int level, int y) {
+    level = std::max(MIN_ZOOM_LEVEL, std::min(MAX_ZOOM_LEVEL, level));
+    if (level == view.zoomLevel) return;
+    y = std::max(y, WORKSPACE_TOP);
+    int row = ScreenToView(0, y).y - ViewOrigin().y;
+    view.zoomLevel = level;
+    view.zoom      = std::pow(ZOOM_STEP, (float)level);
+    int scroll = (int)std::floor(WORKSPACE_TOP / view.zoom) + row - ScreenToView(0, y).y;
+    view.scroll = std::max(0, std::min(MaxScroll(), scroll));
+    MarkDirty({SCRIPTS_X, 0, SCRIPTS_W, WINDOW_H});
+}
+
+// The block at position i
+static BlockHandle WorkspaceBlockAt(int i) {
+    if (i < 0 || i >= workspace.size) return NO_BLOCK;
+    return layout.block[FenwickFind(layout.count, i)];
+}
+
+// ─── Projects ─────────────────────────────────────────────────────────────────
+// Text project format, one statement per line ('#' starts a comment):
+//   sprite <name> [<x> <y> [visible|hidden]]   Scratch coordinates, centre 0,0
+//   <opcode> [<value>]                         a block of the last sprite
+// Opcodes use Scratch 3's names; control_wait counts ticks, not seconds.
+struct ProjectSprite {
+    std::string        name;
+    float              x = 0, y = 0;   // stage coordinates
+    bool               visible = true;
+    Script             script;
+};
+
+struct Project {
+    std::vector<ProjectSprite> sprites;
+    Arena* arena = nullptr;   // where loaders put scripts; null = heap
+};
+
+static const struct { BlockType type; const char* opcode; } BLOCK_OPCODES[] = {
+    {EVENT_FLAG,   "event_whenflagclicked"},
+    {CHANGE_X,     "motion_changexby"},
+    {CHANGE_Y,     "motion_changeyby"},
+    {SET_X,        "motion_setx"},
+    {SET_Y,        "motion_sety"},
+    {LOOKS_SHOW,   "looks_show"},
+    {LOOKS_HIDE,   "looks_hide"},
+    {CONTROL_WAIT, "control_wait"},
+};
+
+static bool BlockTypeFor(const std::string& opcode, BlockType& out) {
+    for (const auto& e : BLOCK_OPCODES)
+        if (opcode == e.opcode) { out = e.type; return true; }
+    return false;
+}
+
+// Parses a text project; on failure returns false with a message in err
+bool LoadProjectText(const std::string& path, Project& out, std::string& err) {
+    std::ifstream in(path);
+    if (!in) { err = path + ": cannot open"; return false; }
+    out.sprites.clear();
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); lineNo++) {
+        std::istringstream ls(line.substr(0, line.find('#')));
+        std::string word;
+        if (!(ls >> word)) continue;
+        auto fail = [&](const char* what) {
+            err = path + ":" + std::to_string(lineNo) + ": " + what;
+            return false;
+        };
+        if (word == "sprite") {
+            ProjectSprite sp;
+            sp.script = NewScript(out.arena);
+            float sx = 0, sy = 0;
+            std::string vis;
+            if (!(ls >> sp.name)) return fail("sprite needs a name");
+            if (ls >> sx >> sy && ls >> vis && vis != "visible" && vis != "hidden")
+                return fail("expected visible or hidden");
+            sp.x       = (STAGE_W / 2.0f) + sx;
+            sp.y       = (STAGE_H / 2.0f) - sy;
+            sp.visible = vis != "hidden";
+            out.sprites.push_back(std::move(sp));
+            continue;
+        }
+        BlockType t;
+        if (!BlockTypeFor(word, t)) return fail("unknown opcode");
+        if (out.sprites.empty())    return fail("block before the first sprite");
+        int value = 0;
+        if (HasValue(t) && !(ls >> value)) return fail("missing value");
+        out.sprites.back().script.push_back(MakeBlock(t, value));
+    }
+    return true;
+}
+
+// Binary project format (.scb), host byte order, every record 4-byte aligned
+// so a mapped file is read in place:
+//   ProjectHeader
+//   SpriteRecord[spriteCount]
+//   BlockRecord[blockCount]   all scripts back to back
+//   char[nameBytes]           sprite names, unterminated
+// Block types are stored as BlockType values; a change to that enum needs a
+// new version.
+static const Uint32 PROJECT_MAGIC   = 0x42524353;   // "SCRB"
+static const Uint32 PROJECT_VERSION = 1;
+
+struct ProjectHeader {
+    Uint32 magic, version;
+    Uint32 spriteCount, blockCount, nameBytes;
+    Uint32 reserved;
+};
+
+struct SpriteRecord {
+    float  x, y;   // stage coordinates
+    Uint32 visible;
+    Uint32 firstBlock, blockCount;
+    Uint32 nameOffset, nameLength;
+};
+
+struct BlockRecord {
+    Uint8  type, category;
+    Uint16 reserved;
+    Sint32 operand;
+};
+
+static_assert(sizeof(ProjectHeader) == 24 && sizeof(SpriteRecord) == 28 && sizeof(BlockRecord) == 8,
+              "project records are written as-is");
+
+struct MappedFile {
+    const Uint8* data = nullptr;
+    size_t       size = 0;
+#if !PROJECT_MMAP
+    std::vector<Uint8> buffer;   // no mmap here; the file is read whole
+#endif
+};
+
+static bool MapFile(const std::string& path, MappedFile& f) {
+#if PROJECT_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    f.data = (const Uint8*)p;
+    f.size = (size_t)st.st_size;
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    f.buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    f.data = f.buffer.data();
+    f.size = f.buffer.size();
+#endif
+    return true;
+}
+
+static void UnmapFile(MappedFile& f) {
+#if PROJECT_MMAP
+    if (f.data) munmap((void*)f.data, f.size);
+#else
+    f.buffer.clear();
+#endif
+    f.data = nullptr;
+    f.size = 0;
+}
+
+// A binary project read in place from its mapping
+struct ProjectView {
+    const ProjectHeader* header  = nullptr;
+    const SpriteRecord*  sprites = nullptr;
+    const BlockRecord*   blocks  = nullptr;
+    const char*          names   = nullptr;
+};
+
+// Checks the header and every sprite record's ranges, then points v into f
+static bool ViewProject(const MappedFile& f, ProjectView& v, std::string& err) {
+    if (f.size < sizeof(ProjectHeader)) { err = "not a project file"; return false; }
+    const ProjectHeader* h = (const ProjectHeader*)f.data;
+    if (h->magic != PROJECT_MAGIC)     { err = "not a project file"; return false; }
+    if (h->version != PROJECT_VERSION) { err = "unsupported version " + std::to_string(h->version); return false; }
+    Uint64 spriteBytes = (Uint64)h->spriteCount * sizeof(SpriteRecord);
+    Uint64 blockBytes  = (Uint64)h->blockCount  * sizeof(BlockRecord);
+    if (sizeof(ProjectHeader) + spriteBytes + blockBytes + h->nameBytes != f.size) {
+        err = "truncated or oversized";
+        return false;
+    }
+    v.header  = h;
+    v.sprites = (const SpriteRecord*)(h + 1);
+    v.blocks  = (const BlockRecord*)(v.sprites + h->spriteCount);
+    v.names   = (const char*)(v.blocks + h->blockCount);
+    for (Uint32 i = 0; i < h->spriteCount; i++) {
+        const SpriteRecord& s = v.sprites[i];
+        if ((Uint64)s.firstBlock + s.blockCount > h->blockCount ||
+            (Uint64)s.nameOffset + s.nameLength > h->nameBytes) {
+            err = "sprite " + std::to_string(i) + " out of range";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LoadProjectBinary(const std::string& path, Project& out, std::string& err) {
+    MappedFile f;
+    if (!MapFile(path, f)) { err = path + ": cannot open"; return false; }
+    ProjectView v;
+    bool ok = ViewProject(f, v, err);
+    out.sprites.clear();
+    if (ok) out.sprites.resize(v.header->spriteCount);
+    for (Uint32 i = 0; ok && i < v.header->spriteCount; i++) {
+        const SpriteRecord& s  = v.sprites[i];
+        ProjectSprite&      sp = out.sprites[i];
+        sp.name.assign(v.names + s.nameOffset, s.nameLength);
+        sp.x       = s.x;
+        sp.y       = s.y;
+        sp.visible = s.visible != 0;
+        sp.script  = NewScript(out.arena);
+        sp.script.resize(s.blockCount);
+        for (Uint32 k = 0; k < s.blockCount; k++) {
+            const BlockRecord& b = v.blocks[s.firstBlock + k];
+            if (b.type <= CONTROL_WAIT) sp.script[k] = MakeBlock((BlockType)b.type, b.operand);
+            if (b.type > CONTROL_WAIT || b.category != sp.script[k].category) {
+                err = "sprite " + std::to_string(i) + " block " + std::to_string(k) + " is corrupt";
+                ok = false;
+                break;
+            }
+        }
+    }
+    UnmapFile(f);
+    if (!ok) err = path + ": " + err;
+    return ok;
+}
+
+bool SaveProjectBinary(const std::string& path, const Project& p, std::string& err) {
+    ProjectHeader h{PROJECT_MAGIC, PROJECT_VERSION, (Uint32)p.sprites.size(), 0, 0, 0};
+    std::vector<SpriteRecord> spriteRecs;
+    std::vector<BlockRecord>  blockRecs;
+    std::string names;
+    for (const ProjectSprite& sp : p.sprites) {
+        spriteRecs.push_back({sp.x, sp.y, sp.visible ? 1u : 0u, (Uint32)blockRecs.size(),
+                              (Uint32)sp.script.size(), (Uint32)names.size(), (Uint32)sp.name.size()});
+        names += sp.name;
+        for (const Block& b : sp.script)
+            blockRecs.push_back({(Uint8)b.type, (Uint8)b.category, 0, b.steps});
+    }
+    h.blockCount = (Uint32)blockRecs.size();
+    h.nameBytes  = (Uint32)names.size();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write((const char*)&h, sizeof(h));
+    out.write((const char*)spriteRecs.data(), spriteRecs.size() * sizeof(SpriteRecord));
+    out.write((const char*)blockRecs.data(),  blockRecs.size()  * sizeof(BlockRecord));
+    out.write(names.data(), names.size());
+    if (!out.flush()) { err = path + ": write failed"; return false; }
+    return true;
+}
+
+bool ImportScratchProject(const std::string& path, Project& out, std::string& err);
+
+// Loads any supported format: binary by its magic, Scratch 3 JSON by its
+// opening brace, text otherwise
+bool LoadProject(const std::string& path, Project& out, std::string& err) {
+    Uint32 magic = 0;
+    std::ifstream in(path, std::ios::binary);
+    in.read((char*)&magic, sizeof(magic));
+    if (magic == PROJECT_MAGIC) return LoadProjectBinary(path, out, err);
+    in.clear();
+    in.seekg(0);
+    char c = 0;
+    in >> c;
+    return c == '{' ? ImportScratchProject(path, out, err) : LoadProjectText(path, out, err);
+}
+
+// ─── Scratch Import ───────────────────────────────────────────────────────────
+// Reads a Scratch 3 project.json (extract it from the .sb3 zip first) with a
+// pull tokenizer over a fixed buffer, so memory grows with the sprites' block
+// tables, never with the file. Each sprite keeps its first green-flag script,
+// followed through `next`; every other block is skipped and counted by opcode.
+enum JsonToken {
+    JSON_END, JSON_ERROR, JSON_OBJECT_BEGIN, JSON_OBJECT_END, JSON_ARRAY_BEGIN, JSON_ARRAY_END,
+    JSON_KEY, JSON_STRING, JSON_NUMBER, JSON_TRUE, JSON_FALSE, JSON_NULL
+};
+
+static const size_t JSON_BUFFER    = 1 << 16;
+static const size_t JSON_MAX_TEXT  = 4096;   // longer strings are cut, not stored
+static const size_t JSON_MAX_DEPTH = 256;
+
+struct JsonReader {
+    std::ifstream     in;
+    std::vector<char> buf = std::vector<char>(JSON_BUFFER);
+    size_t            pos = 0, len = 0;
+    Uint64            offset  = 0;       // bytes consumed, for errors
+    std::string       text;              // key, string or number of the last token
+    std::string       error;
+    std::vector<char> stack;             // '{' or '[' per open container
+    bool              wantKey = false;   // the next string in this object is a key
+};
+
+static int PeekJson(JsonReader& j) {
+    if (j.pos == j.len) {
+        j.in.read(j.buf.data(), (std::streamsize)j.buf.size());
+        j.len = (size_t)j.in.gcount();
+        j.pos = 0;
+        if (j.len == 0) return -1;
+    }
+    return (unsigned char)j.buf[j.pos];
+}
+
+static int GetJson(JsonReader& j) {
+    int c = PeekJson(j);
+    if (c >= 0) { j.pos++; j.offset++; }
+    return c;
+}
+
+static JsonToken JsonFail(JsonReader& j, const char* what) {
+    if (j.error.empty()) j.error = std::string(what) + " at byte " + std::to_string(j.offset);
+    return JSON_ERROR;
+}
+
+static void AppendJsonText(JsonReader& j, Uint32 cp) {
+    char u[4];
+    int  n = 0;
+    if (cp < 0x80)         u[n++] = (char)cp;
+    else if (cp < 0x800) { u[n++] = (char)(0xC0 | cp >> 6);  u[n++] = (char)(0x80 | (cp & 0x3F)); }
+    else if (cp < 0x10000) {
+        u[n++] = (char)(0xE0 | cp >> 12);
+        u[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        u[n++] = (char)(0x80 | (cp & 0x3F));
+    } else {
+        u[n++] = (char)(0xF0 | cp >> 18);
+        u[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        u[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        u[n++] = (char)(0x80 | (cp & 0x3F));
+    }
+    if (j.text.size() + n <= JSON_MAX_TEXT) j.text.append(u, n);
+}
+
+static bool ReadJsonHex(JsonReader& j, Uint32& cp) {
+    cp = 0;
+    for (int k = 0; k < 4; k++) {
+        int c = GetJson(j);
+        int d = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (d < 0) return false;
+        cp = cp << 4 | (Uint32)d;
+    }
+    return true;
+}
+
+// Reads the string after its opening quote into j.text
+static bool ReadJsonString(JsonReader& j) {
+    j.text.clear();
+    for (;;) {
+        int c = GetJson(j);
+        if (c < 0) return false;
+        if (c == '"') return true;
+        if (c != '\\') {
+            if (j.text.size() < JSON_MAX_TEXT) j.text += (char)c;
+            continue;
+        }
+        Uint32 cp;
+        switch (c = GetJson(j)) {
+            case 'b': cp = '\b'; break;
+            case 'f': cp = '\f'; break;
+            case 'n': cp = '\n'; break;
+            case 'r': cp = '\r'; break;
+            case 't': cp = '\t'; break;
+            case 'u':
+                if (!ReadJsonHex(j, cp)) return false;
+                if (cp >= 0xD800 && cp < 0xDC00) {   // high surrogate; the low half follows
+                    Uint32 lo;
+                    if (GetJson(j) != '\\' || GetJson(j) != 'u' || !ReadJsonHex(j, lo)) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                break;
+            case '"': case '\\': case '/': cp = (Uint32)c; break;
+            default: return false;
+        }
+        AppendJsonText(j, cp);
+    }
+}
+
+// Next token; commas and colons are taken as plain separators
+static JsonToken NextJson(JsonReader& j) {
+    int c;
+    while ((c = PeekJson(j)) == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',' || c == ':')
+        GetJson(j);
+    if (c < 0) return j.stack.empty() ? JSON_END : JsonFail(j, "unexpected end");
+    bool inObject = !j.stack.empty() && j.stack.back() == '{';
+    if (inObject && j.wantKey && c != '"' && c != '}') return JsonFail(j, "expected a key");
+    GetJson(j);
+    switch (c) {
+        case '{':
+        case '[':
+            if (j.stack.size() >= JSON_MAX_DEPTH) return JsonFail(j, "nested too deep");
+            j.stack.push_back((char)c);
+            j.wantKey = c == '{';
+            return c == '{' ? JSON_OBJECT_BEGIN : JSON_ARRAY_BEGIN;
+        case '}':
+        case ']':
+            if (j.stack.empty() || j.stack.back() != (c == '}' ? '{' : '[')) return JsonFail(j, "mismatched bracket");
+            j.stack.pop_back();
+            j.wantKey = !j.stack.empty() && j.stack.back() == '{';
+            return c == '}' ? JSON_OBJECT_END : JSON_ARRAY_END;
+        case '"': {
+            if (!ReadJsonString(j)) return JsonFail(j, "bad string");
+            bool key  = inObject && j.wantKey;
+            j.wantKey = inObject && !key;
+            return key ? JSON_KEY : JSON_STRING;
+        }
+    }
+    j.text.assign(1, (char)c);
+    while ((c = PeekJson(j)) >= 0 && (std::isalnum(c) || c == '.' || c == '-' || c == '+'))
+        if (j.text.size() < 64) j.text += (char)GetJson(j);
+        else GetJson(j);
+    j.wantKey = inObject;
+    if (j.text == "true")  return JSON_TRUE;
+    if (j.text == "false") return JSON_FALSE;
+    if (j.text == "null")  return JSON_NULL;
+    char* end;
+    std::strtod(j.text.c_str(), &end);
+    if (*end != '\0') return JsonFail(j, "bad literal");
+    return JSON_NUMBER;
+}
+
+// Skips the rest of a value whose first token was t
+static bool SkipJson(JsonReader& j, JsonToken t) {
+    if (t == JSON_ERROR || t == JSON_END) return false;
+    if (t != JSON_OBJECT_BEGIN && t != JSON_ARRAY_BEGIN) return true;
+    size_t depth = j.stack.size();
+    while (j.stack.size() >= depth)
+        if ((t = NextJson(j)) == JSON_ERROR) return false;
+    return true;
+}
+
+static double JsonNumber(const JsonReader& j) {
+    return std::strtod(j.text.c_str(), nullptr);
+}
+
+struct ImportStats {
+    Uint64 blocks   = 0;   // non-shadow blocks read
+    Uint64 imported = 0;
+    std::unordered_map<std::string, Uint64> skipped;   // by opcode
+};
+
+ImportStats importStats;
+
+struct ImportBlock {
+    std::string id, next, opcode;
+    bool   topLevel = false;
+    bool   shadow   = false;
+    bool   literal  = false;   // its input is a plain value, not a reporter
+    double value    = 0;
+};
+
+// Scratch primitive types 4..10 (number, positive number, whole number,
+// integer, angle, colour, text) carry a value; 11..13 (broadcast, variable,
+// list) name something instead
+static const int SB3_FIRST_VALUE_TYPE = 4;
+static const int SB3_LAST_VALUE_TYPE  = 10;
+
+// One input, e.g. "DX": [1, [4, "10"]]; a block id in place of the
+// [type, value] pair means a reporter is plugged in, and a variable or list
+// there ([3, [12, "name", "id"], [4, "10"]]) leaves the block unsupported
+static bool ImportInput(JsonReader& j, ImportBlock& b) {
+    JsonToken t = NextJson(j);
+    if (t != JSON_ARRAY_BEGIN) return SkipJson(j, t);
+    for (int k = 0; (t = NextJson(j)) != JSON_ARRAY_END; k++) {
+        if (t == JSON_ARRAY_BEGIN && k == 1) {
+            int type = 0;
+            for (int m = 0; (t = NextJson(j)) != JSON_ARRAY_END; m++) {
+                if (m == 0 && t == JSON_NUMBER) type = (int)JsonNumber(j);
+                if (m == 1 && type >= SB3_FIRST_VALUE_TYPE && type <= SB3_LAST_VALUE_TYPE &&
+                    (t == JSON_STRING || t == JSON_NUMBER)) {
+                    b.literal = true;
+                    b.value   = JsonNumber(j);
+                }
+                if (!SkipJson(j, t)) return false;
+            }
+        } else if (!SkipJson(j, t)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ImportBlockObject(JsonReader& j, ImportBlock& b) {
+    JsonToken t;
+    while ((t = NextJson(j)) == JSON_KEY) {
+        std::string key = j.text;
+        t = NextJson(j);
+        if      (key == "opcode"   && t == JSON_STRING) b.opcode   = j.text;
+        else if (key == "next"     && t == JSON_STRING) b.next     = j.text;
+        else if (key == "topLevel")                     b.topLevel = t == JSON_TRUE;
+        else if (key == "shadow")                       b.shadow   = t == JSON_TRUE;
+        else if (key == "inputs"   && t == JSON_OBJECT_BEGIN) {
+            while ((t = NextJson(j)) == JSON_KEY)
+                if (!ImportInput(j, b)) return false;
+            if (t != JSON_OBJECT_END) return false;
+        } else if (!SkipJson(j, t)) {
+            return false;
+        }
+    }
+    return t == JSON_OBJECT_END;
+}
+
+// Turns one target's block table into its script, counting what was left
+// out; the stage has no script here, so all of its blocks are skipped
+static void BuildImportedScript(const std::vector<ImportBlock>& blocks, bool stage, ProjectSprite& sp) {
+    std::unordered_map<std::string, int> byId;
+    int head = -1;
+    for (int i = 0; i < (int)blocks.size(); i++) {
+        byId[blocks[i].id] = i;
+        if (!stage && head < 0 && blocks[i].topLevel && blocks[i].opcode == "event_whenflagclicked") head = i;
+    }
+    std::vector<bool> used(blocks.size(), false);
+    for (int i = head, n = 0; i >= 0 && n < (int)blocks.size() && !used[i]; n++) {
+        const ImportBlock& b = blocks[i];
+        BlockType t;
+        if (BlockTypeFor(b.opcode, t) && (b.literal || !HasValue(t))) {
+            double v = t == CONTROL_WAIT ? b.value * 1000.0 / STEP_DELAY : b.value;   // seconds to ticks
+            v = std::max(-2e9, std::min(2e9, v));
+            sp.script.push_back(MakeBlock(t, (int)std::lround(v)));
+            used[i] = true;
+        }
+        auto next = b.next.empty() ? byId.end() : byId.find(b.next);
+        i = next == byId.end() ? -1 : next->second;
+    }
+    for (int i = 0; i < (int)blocks.size(); i++) {
+        if (blocks[i].shadow) continue;
+        importStats.blocks++;
+        if (used[i]) importStats.imported++;
+        else         importStats.skipped[blocks[i].opcode]++;
+    }
+}
+
+static bool ImportTarget(JsonReader& j, Project& out) {
+    ProjectSprite sp;
+    sp.script = NewScript(out.arena);
+    bool   stage = false;
+    double x = 0, y = 0;
+    std::vector<ImportBlock> blocks;
+    JsonToken t;
+    while ((t = NextJson(j)) == JSON_KEY) {
+        std::string key = j.text;
+        t = NextJson(j);
+        if      (key == "isStage")                     stage = t == JSON_TRUE;
+        else if (key == "name"    && t == JSON_STRING) sp.name = j.text;
+        else if (key == "x"       && t == JSON_NUMBER) x = JsonNumber(j);
+        else if (key == "y"       && t == JSON_NUMBER) y = JsonNumber(j);
+        else if (key == "visible")                     sp.visible = t != JSON_FALSE;
+        else if (key == "blocks"  && t == JSON_OBJECT_BEGIN) {
+            while ((t = NextJson(j)) == JSON_KEY) {
+                ImportBlock b;
+                b.id = j.text;
+                t = NextJson(j);
+                if (t != JSON_OBJECT_BEGIN) {   // a loose variable or list reporter
+                    if (!SkipJson(j, t)) return false;
+                    continue;
+                }
+                if (!ImportBlockObject(j, b)) return false;
+                blocks.push_back(std::move(b));
+            }
+            if (t != JSON_OBJECT_END) return false;
+        } else if (!SkipJson(j, t)) {
+            return false;
+        }
+    }
+    if (t != JSON_OBJECT_END) return false;
+    BuildImportedScript(blocks, stage, sp);
+    if (stage) return true;
+    for (char& c : sp.name) if (std::isspace((unsigned char)c)) c = '_';
+    if (sp.name.empty()) sp.name = "Sprite" + std::to_string(out.sprites.size() + 1);
+    sp.x = (STAGE_W / 2.0f) + (float)x;
+    sp.y = (STAGE_H / 2.0f) - (float)y;
+    out.sprites.push_back(std::move(sp));
+    return true;
+}
+
+bool ImportScratchProject(const std::string& path, Project& out, std::string& err) {
+    JsonReader j;
+    j.in.open(path, std::ios::binary);
+    if (!j.in) { err = path + ": cannot open"; return false; }
+    out.sprites.clear();
+    JsonToken t = NextJson(j);
+    bool ok = t == JSON_OBJECT_BEGIN;
+    while (ok && (t = NextJson(j)) == JSON_KEY) {
+        if (j.text != "targets") { ok = SkipJson(j, NextJson(j)); continue; }
+        if (NextJson(j) != JSON_ARRAY_BEGIN) { ok = false; break; }
+        while (ok && (t = NextJson(j)) != JSON_ARRAY_END)
+            ok = t == JSON_OBJECT_BEGIN ? ImportTarget(j, out) : SkipJson(j, t);
+    }
+    ok = ok && t == JSON_OBJECT_END && NextJson(j) == JSON_END;
+    if (!ok) err = path + ": " + (j.error.empty() ? "not a Scratch 3 project at byte " + std::to_string(j.offset) : j.error);
+    return ok;
+}
+
+// One line of totals, then the skipped opcodes, most frequent first
+void PrintImportStats() {
+    const ImportStats& s = importStats;
+    if (s.blocks == 0) return;
+    std::vector<std::pair<std::string, Uint64>> skipped(s.skipped.begin(), s.skipped.end());
+    std::sort(skipped.begin(), skipped.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    std::cout << "Scratch import: " << s.imported << " of " << s.blocks << " blocks\n";
+    for (const auto& e : skipped) std::cout << "  skipped " << e.first << " x" << e.second << "\n";
+}
+
+// ─── Bytecode ─────────────────────────────────────────────────────────────────
+// StartScript lowers the workspace into a flat program the interpreter runs
+// without touching layout data. srcIndex maps each instruction back to its
+// block so the UI can highlight it; the VM never reads it.
+enum Opcode : Uint8 { OP_NOP, OP_CHANGE_X, OP_CHANGE_Y, OP_SET_X, OP_SET_Y, OP_SHOW, OP_HIDE,
+                      OP_MOVE_X, OP_MOVE_Y,   // fused: arg indexes Program::moves
+                      OP_WAIT };              // arg ticks; skipped in turbo
+
+struct Instr {
+    Uint8  op;
+    Sint32 arg;
+};
+
+// v = clamp(v + d, lo, hi): a run of clamped motion steps on one axis
+struct ClampAdd {
+    double d;
+    float  lo, hi;
+};
+
+struct Program {
+    ArenaVector<Instr>    code;
+    ArenaVector<int>      srcIndex;
+    ArenaVector<ClampAdd> moves;
+    int                   srcEnd = 0;   // block index after the last instruction
+
+    explicit Program(Arena* a = nullptr)
+        : code(ArenaAllocator<Instr>(a)), srcIndex(ArenaAllocator<int>(a)), moves(ArenaAllocator<ClampAdd>(a)) {}
+};
+
+Program program;   // every sprite's code, back to back
+bool programOptimized = false;   // compiled for turbo, motion runs fused
+
+static Opcode OpcodeFor(BlockType t) {
+    switch (t) {
+        case CHANGE_X:   return OP_CHANGE_X;
+        case CHANGE_Y:   return OP_CHANGE_Y;
+        case SET_X:      return OP_SET_X;
+        case SET_Y:      return OP_SET_Y;
+        case LOOKS_SHOW: return OP_SHOW;
+        case LOOKS_HIDE: return OP_HIDE;
+        case CONTROL_WAIT: return OP_WAIT;
+        default:         return OP_NOP;   // hats inside a stack still take a step
+    }
+}
+
+static void CompileScript(const Script& blocks, int start, Program& out) {
+    out.code.clear();
+    out.srcIndex.clear();
+    out.code.reserve(blocks.size());
+    out.srcIndex.reserve(blocks.size());
+    out.moves.clear();
+    for (int i = start; i < (int)blocks.size(); i++) {
+        out.code.push_back({(Uint8)OpcodeFor(blocks[i].type), blocks[i].steps});
+        out.srcIndex.push_back(i);
+    }
+    out.srcEnd = std::max(start, (int)blocks.size());
+}
+
+// Appends one sprite's compiled script to `program` and points the sprite at it
+static void LoadSpriteProgram(int i, const Program& p) {
+    int base     = (int)program.code.size();
+    int moveBase = (int)program.moves.size();
+    for (Instr in : p.code) {
+        if (in.op == OP_MOVE_X || in.op == OP_MOVE_Y) in.arg += moveBase;
+        program.code.push_back(in);
+    }
+    program.srcIndex.insert(program.srcIndex.end(), p.srcIndex.begin(), p.srcIndex.end());
+    program.moves.insert(program.moves.end(), p.moves.begin(), p.moves.end());
+    sprites.pc[i]      = base;
+    sprites.codeEnd[i] = (int)program.code.size();
+    sprites.srcEnd[i]  = p.srcEnd;
+}
+
+// Source block position of sprite i at instruction `at`. Differences count
+// retired blocks; fused instructions count every block they replace.
+static int SrcPos(int i, int at) {
+    return at < sprites.codeEnd[i] ? program.srcIndex[at] : sprites.srcEnd[i];
+}
+
+// Composition of per-step clamps on one axis, tracked exactly in integers:
+// clamp(clamp(v + D, L, H) + a, 30, M) == clamp(v + D + a, clamp(L + a), clamp(H + a)).
+// Exact only for a start inside [30, M]; see `first` in OptimizeProgram.
+struct AxisFold {
+    bool      used = false;
+    long long d = 0, lo = 0, hi = 0;
+    long long min = 30, max = 0;
+
+    void Add(long long a) {
+        if (!used) { used = true; d = 0; lo = min; hi = max; }
+        d += a;
+        lo = std::max(min, std::min(max, lo + a));
+        hi = std::max(min, std::min(max, hi + a));
+    }
+    void Set(long long v) {
+        used = true;
+        lo = hi = std::max(min, std::min(max, v));
+        d = 0;
+    }
+};
+
+// Peephole pass for runs where intermediate frames aren't observable (turbo,
+// headless). Motion on one axis doesn't read the other axis or visibility, so
+// within a window all X steps fold into one clamped move, all Y steps into
+// another, and only the last visibility write survives. The per-step
+// 30..STAGE-30 clamp is preserved exactly by AxisFold. Opcodes the pass
+// doesn't know close the window.
+static void OptimizeProgram(Program& p) {
+    Program out(p.code.get_allocator().arena);
+    out.srcEnd = p.srcEnd;
+    AxisFold fx, fy;
+    fx.max = STAGE_W - 30;
+    fy.max = STAGE_H - 30;
+    int vis = -1;           // -1 untouched, else OP_SHOW / OP_HIDE
+    int windowStart = -1;   // first source block of the open window
+    // A loaded sprite can stand off-stage until the program's first step
+    // clamps both axes, so that step is kept as is and folding starts after
+    bool first = true;
+
+    auto emitAxis = [&](AxisFold& f, Opcode setOp, Opcode changeOp, Opcode moveOp,
+                        long long center, long long sign) {
+        if (!f.used) return;
+        Instr in;
+        if (f.lo == f.hi) {
+            in = {(Uint8)setOp, (Sint32)(sign * (f.lo - center))};
+        } else if (f.lo == f.min && f.hi == f.max && f.d >= INT32_MIN && f.d <= INT32_MAX &&
+                   sign * f.d >= INT32_MIN && sign * f.d <= INT32_MAX) {
+            in = {(Uint8)changeOp, (Sint32)(sign * f.d)};
+        } else {
+            in = {(Uint8)moveOp, (Sint32)out.moves.size()};
+            out.moves.push_back({(double)f.d, (float)f.lo, (float)f.hi});
+        }
+        out.code.push_back(in);
+        f.used = false;
+    };
+    auto flush = [&]() {
+        if (windowStart < 0) return;
+        size_t before = out.code.size();
+        emitAxis(fx, OP_SET_X, OP_CHANGE_X, OP_MOVE_X, STAGE_W / 2,  1);
+        emitAxis(fy, OP_SET_Y, OP_CHANGE_Y, OP_MOVE_Y, STAGE_H / 2, -1);
+        if (vis >= 0) out.code.push_back({(Uint8)vis, 0});
+        // A window of hats alone still retires its blocks
+        if (vis < 0 && out.code.size() == before) out.code.push_back({(Uint8)OP_NOP, 0});
+        out.srcIndex.resize(out.code.size(), windowStart);
+        vis = -1;
+        windowStart = -1;
+    };
+    auto keep = [&](size_t i) {
+        out.code.push_back(p.code[i]);
+        out.srcIndex.push_back(p.srcIndex[i]);
+        if (p.code[i].op == OP_MOVE_X || p.code[i].op == OP_MOVE_Y) {
+            out.code.back().arg = (Sint32)out.moves.size();
+            out.moves.push_back(p.moves[p.code[i].arg]);
+        }
+    };
+
+    for (size_t i = 0; i < p.code.size(); i++) {
+        const Instr& in = p.code[i];
+        bool foldable = in.op <= OP_HIDE;
+        if (first) { first = false; keep(i); continue; }
+        if (foldable && windowStart < 0) windowStart = p.srcIndex[i];
+        switch (in.op) {
+            case OP_NOP:      break;
+            case OP_CHANGE_X: fx.Add(in.arg);  break;
+            case OP_CHANGE_Y: fy.Add(-(long long)in.arg); break;
+            case OP_SET_X:    fx.Set(STAGE_W / 2 + (long long)in.arg); break;
+            case OP_SET_Y:    fy.Set(STAGE_H / 2 - (long long)in.arg); break;
+            case OP_SHOW:
+            case OP_HIDE:     vis = in.op; break;
+            default:
+                flush();
+                keep(i);
+                break;
+        }
+    }
+    flush();
+    p = std::move(out);
+}
+
+// Runs up to maxInstrs of sprite i's code; returns the source blocks retired.
+// Touches only sprite i, so different sprites can run on different threads.
+static int ExecSprite(int i, int maxInstrs) {
+    SpriteTable& s = sprites;
+    int pc  = s.pc[i];
+    int end = std::min(s.codeEnd[i], pc + maxInstrs);
+    if (pc >= end) return 0;
+    const Instr* code = program.code.data();
+    int   start = pc;
+    float x = s.x[i], y = s.y[i];
+    bool  vis = IsVisible(i);
+    for (; pc < end; pc++) {
+        const Instr& in = code[pc];
+        switch (in.op) {
+            case OP_CHANGE_X: x += in.arg; break;
+            case OP_CHANGE_Y: y -= in.arg; break;
+            case OP_SET_X:    x = (STAGE_W / 2.0f) + in.arg; break;
+            case OP_SET_Y:    y = (STAGE_H / 2.0f) - in.arg; break;
+            case OP_SHOW:     vis = true;  break;
+            case OP_HIDE:     vis = false; break;
+            case OP_MOVE_X: {
+                const ClampAdd& m = program.moves[in.arg];
+                x = (float)std::max((double)m.lo, std::min((double)m.hi, x + m.d));
+                break;
+            }
+            case OP_MOVE_Y: {
+                const ClampAdd& m = program.moves[in.arg];
+                y = (float)std::max((double)m.lo, std::min((double)m.hi, y + m.d));
+                break;
+            }
+            default: break;
+        }
+        x = std::max(30.0f, std::min((float)STAGE_W - 30, x));
+        y = std::max(30.0f, std::min((float)STAGE_H - 30, y));
+    }
+    s.x[i] = x;
+    s.y[i] = y;
+    SetVisible(i, vis);
+    s.pc[i] = pc;
+    return SrcPos(i, pc) - SrcPos(i, start);
+}
+
+// Differential check of OptimizeProgram: n random programs, started on and
+// off stage, run plain and optimized through ExecSprite. Returns mismatches.
+int CheckOptimizer(int n) {
+    Uint32 seed = 0x9e3779b9;
+    auto rnd = [&seed](int m) {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        return (int)(seed % (Uint32)m);
+    };
+    int bad = 0;
+    for (int k = 0; k < n; k++) {
+        Script script = NewScript(nullptr);
+        for (int len = rnd(24), j = 0; j < len; j++) {
+            int kind = rnd(4);
+            int v = kind == 0 ? rnd(41) - 20 : kind == 1 ? rnd(801) - 400 : kind == 2 ? (int)seed : 0;
+            script.push_back(MakeBlock((BlockType)rnd(CONTROL_WAIT + 1), v));
+        }
+        float x0 = (float)(rnd(STAGE_W + 600) - 300), y0 = (float)(rnd(STAGE_H + 600) - 300);
+        bool  v0 = rnd(2);
+        float x[2], y[2];
+        bool  vis[2];
+        int   retired[2];
+        Program p;
+        CompileScript(script, 0, p);
+        for (int opt = 0; opt < 2; opt++) {
+            if (opt) OptimizeProgram(p);
+            sprites = SpriteTable{};
+            program = Program{};
+            AddSprite(x0, y0, v0);
+            LoadSpriteProgram(0, p);
+            retired[opt] = ExecSprite(0, (int)p.code.size());
+            x[opt] = sprites.x[0];
+            y[opt] = sprites.y[0];
+            vis[opt] = IsVisible(0);
+        }
+        if (x[0] == x[1] && y[0] == y[1] && vis[0] == vis[1] && retired[0] == retired[1]) continue;
+        if (bad++ == 0)
+            std::cout << "optimizer mismatch: start " << x0 << "," << y0 << " " << script.size()
+                      << " blocks -> " << x[0] << "," << y[0] << " vs " << x[1] << "," << y[1] << "\n";
+    }
+    sprites = SpriteTable{};
+    program = Program{};
+    std::cout << "optimizer: " << n << " programs, " << bad << " mismatches\n";
+    return bad;
+}
+
+// ─── Motion Kernel ────────────────────────────────────────────────────────────
+// A tick applies one affine update per sprite and axis, then the stage clamp:
+//   out = clamp(in * keep + add, 30, STAGE - 30)
+// with keep = 0 for SET and 1 otherwise. Since keep is exactly 0 or 1 the
+// result is bit-identical to the scalar interpreter, FMA or not.
+struct MotionLanes {
+    std::vector<float> keepX, addX, keepY, addY;
+};
+
+MotionLanes lanes;
+
+typedef void (*MotionKernel)(float* out, const float* in, const float* keep, const float* add,
+                             int n, float lo, float hi);
+
+static void MotionScalar(float* out, const float* in, const float* keep, const float* add,
+                         int n, float lo, float hi) {
+    for (int i = 0; i < n; i++)
+        out[i] = std::max(lo, std::min(hi, in[i] * keep[i] + add[i]));
+}
+
+#ifdef MOTION_X86
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse2")))   // not implied on 32-bit x86
+#endif
+static void MotionSSE2(float* out, const float* in, const float* keep, const float* add,
+                       int n, float lo, float hi) {
+    __m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(keep + i)), _mm_loadu_ps(add + i));
+        _mm_storeu_ps(out + i, _mm_max_ps(_mm_min_ps(x, vhi), vlo));
+    }
+    MotionScalar(out + i, in + i, keep + i, add + i, n - i, lo, hi);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+static void MotionAVX2(float* out, const float* in, const float* keep, const float* add,
+                       int n, float lo, float hi) {
+    __m256 vlo = _mm256_set1_ps(lo), vhi = _mm256_set1_ps(hi);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), _mm256_loadu_ps(keep + i)),
+                                 _mm256_loadu_ps(add + i));
+        _mm256_storeu_ps(out + i, _mm256_max_ps(_mm256_min_ps(x, vhi), vlo));
+    }
+    MotionSSE2(out + i, in + i, keep + i, add + i, n - i, lo, hi);
+}
+#endif
+
+static MotionKernel SelectMotionKernel() {
+#ifdef MOTION_X86
+    if (SDL_HasAVX2()) return MotionAVX2;
+    if (SDL_HasSSE2()) return MotionSSE2;
+#endif
+    return MotionScalar;
+}
+
+MotionKernel motionKernel = SelectMotionKernel();
+
+// Times each available kernel over n sprites and prints sprites per second
+void BenchMotion(int n) {
+    struct { const char* name; MotionKernel fn; } kernels[] = {
+        {"scalar", MotionScalar},
+#ifdef MOTION_X86
+        {"sse2",   SDL_HasSSE2() ? MotionSSE2 : nullptr},
+        {"avx2",   SDL_HasAVX2() ? MotionAVX2 : nullptr},
+#endif
+    };
+    std::vector<float> v(n), keep(n), add(n);
+    for (const auto& k : kernels) {
+        if (!k.fn) continue;
+        for (int i = 0; i < n; i++) {
+            v[i]    = 30.0f + i % 340;
+            keep[i] = (i % 3) ? 1.0f : 0.0f;
+            add[i]  = keep[i] ? (float)(i % 21 - 10) : 200.0f;
+        }
+        int    reps  = std::max(1, 200000000 / std::max(1, n));
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int rep = 0; rep < reps; rep++)
+            k.fn(v.data(), v.data(), keep.data(), add.data(), n, 30.0f, STAGE_W - 30.0f);
+        double secs = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+        std::cout << k.name << ": " << (Uint64)((double)n * reps / secs) << " sprites/s"
+                  << (k.fn == motionKernel ? "  (selected)" : "") << " [checksum " << v[n / 2] << "]\n";
+    }
+}
+
+// ─── Thread Pool ──────────────────────────────────────────────────────────────
+// Work-stealing pool for per-tick parallel loops. Work is split into chunks;
+// each queue owner pops from the back of its deque and steals from the front
+// of the others. The calling thread owns the last queue and works too, and
+// ParallelFor returns only when every chunk is done (the tick barrier).
+typedef void (*ChunkFn)(int chunk);
+
+struct WorkQueue {
+    std::mutex      m;
+    std::deque<int> chunks;
+};
+
+struct ThreadPool {
+    std::vector<std::thread>                threads;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    ChunkFn                 job = nullptr;
+    std::atomic<int>        pending{0};
+    std::mutex              m;
+    std::condition_variable wake, done;
+    Uint64                  generation = 0;
+    bool                    quit = false;
+};
+
+ThreadPool pool;
+int threadCount = 0;   // --threads; 0 = one per core
+
+static bool PopChunk(int self, int& chunk) {
+    int q = (int)pool.queues.size();
+    for (int k = 0; k < q; k++) {
+        WorkQueue& wq = *pool.queues[(self + k) % q];
+        std::lock_guard<std::mutex> lock(wq.m);
+        if (wq.chunks.empty()) continue;
+        if (k == 0) { chunk = wq.chunks.back();  wq.chunks.pop_back();  }
+        else        { chunk = wq.chunks.front(); wq.chunks.pop_front(); }
+        return true;
+    }
+    return false;
+}
+
+static void RunChunks(int self) {
+    int chunk;
+    while (PopChunk(self, chunk)) {
+        pool.job(chunk);
+        if (--pool.pending == 0) {
+            std::lock_guard<std::mutex> lock(pool.m);
+            pool.done.notify_all();
+        }
+    }
+}
+
+static void WorkerMain(int self) {
+    Uint64 seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(pool.m);
+            pool.wake.wait(lock, [&] { return pool.quit || pool.generation != seen; });
+            if (pool.quit) return;
+            seen = pool.generation;
+        }
+        RunChunks(self);
+    }
+}
+
+void StartThreadPool(int n) {
+    if (n <= 0) n = SDL_GetCPUCount();
+    for (int i = 0; i < n; i++) pool.queues.emplace_back(new WorkQueue);
+    for (int i = 0; i < n - 1; i++) pool.threads.emplace_back(WorkerMain, i);
+}
+
+void StopThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(pool.m);
+        pool.quit = true;
+    }
+    pool.wake.notify_all();
+    for (std::thread& t : pool.threads) t.join();
+    pool.threads.clear();
+    pool.queues.clear();
+}
+
+// Runs fn(0..n-1) across the pool and waits for all of them
+void ParallelFor(int n, ChunkFn fn) {
+    ThreadPool& p = pool;
+    if (p.threads.empty() || n <= 1) {
+        for (int c = 0; c < n; c++) fn(c);
+        return;
+    }
+    p.job     = fn;   // published to workers by the queue locks below
+    p.pending = n;
+    int q = (int)p.queues.size();
+    for (int w = 0; w < q; w++) {
+        std::lock_guard<std::mutex> lock(p.queues[w]->m);
+        for (int c = w * n / q; c < (w + 1) * n / q; c++) p.queues[w]->chunks.push_back(c);
+    }
+    {
+        std::lock_guard<std::mutex> lock(p.m);
+        p.generation++;
+    }
+    p.wake.notify_all();
+    RunChunks(q - 1);
+    std::unique_lock<std::mutex> lock(p.m);
+    p.done.wait(lock, [&] { return p.pending == 0; });
+}
+
+// ─── Coroutines ───────────────────────────────────────────────────────────────
+// Each running script is a C++20 coroutine. It suspends on an awaitable that
+// says how many ticks to sleep; the scheduler parks it in a timer wheel and
+// resumes it on the tick it is due. A suspended script costs one small frame,
+// with no thread and no hand-written state machine.
+struct ScriptTask {
+    struct promise_type {
+        int sleep = 1;   // ticks requested by the last co_await
+
+        ScriptTask get_return_object() {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+typedef std::coroutine_handle<ScriptTask::promise_type> ScriptHandle;
+
+// co_await Sleep{n}: resume n ticks from now
+struct Sleep {
+    int ticks;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(ScriptHandle h) const noexcept { h.promise().sleep = std::max(1, ticks); }
+    void await_resume() const noexcept {}
+};
+
+// co_await NextTick{}: resume on the next tick (turbo: the next round)
+struct NextTick : Sleep {
+    NextTick() : Sleep{1} {}
+};
+
+// Hierarchical timer wheel over tick numbers. Level L has WHEEL_SLOTS slots
+// of WHEEL_SLOTS^L ticks each; a timer goes in the coarsest level that still
+// resolves it and cascades down as its deadline nears. A tick touches one
+// level-0 slot, whose timers are all due, plus one higher slot every
+// WHEEL_SLOTS^L ticks, so sleeping scripts cost nothing until they wake.
+static const int WHEEL_BITS   = 6;
+static const int WHEEL_SLOTS  = 1 << WHEEL_BITS;
+static const int WHEEL_LEVELS = 4;   // 2^24 ticks; longer waits go round the top level again
+
+struct TimerEntry {
+    Uint64 deadline;
+    int    sprite;
+};
+
+struct TimerWheel {
+    std::vector<TimerEntry> slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    Uint64 now       = 0;
+    Uint64 scheduled = 0;   // counters
+    Uint64 fired     = 0;
+    Uint64 cascaded  = 0;
+};
+
+static void PlaceTimer(TimerWheel& w, const TimerEntry& t) {
+    Uint64 delta = t.deadline - w.now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1))) level++;
+    w.slots[level][(t.deadline >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)].push_back(t);
+}
+
+static void ScheduleTimer(TimerWheel& w, Uint64 deadline, int sprite) {
+    PlaceTimer(w, {deadline, sprite});
+    w.scheduled++;
+}
+
+// Advances one tick and appends the sprites due on it to `due`
+static void AdvanceTimers(TimerWheel& w, std::vector<int>& due) {
+    w.now++;
+    // Coarse slots whose span starts now move down a level, top first
+    for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+        int shift = WHEEL_BITS * level;
+        if (w.now & ((1ull << shift) - 1)) continue;
+        std::vector<TimerEntry> moving;
+        moving.swap(w.slots[level][(w.now >> shift) & (WHEEL_SLOTS - 1)]);
+        for (const TimerEntry& t : moving) PlaceTimer(w, t);
+        w.cascaded += moving.size();
+    }
+    std::vector<TimerEntry>& slot = w.slots[0][w.now & (WHEEL_SLOTS - 1)];
+    for (const TimerEntry& t : slot) due.push_back(t.sprite);
+    w.fired += slot.size();
+    slot.clear();
+}
+
+// Ticks until a slot with timers comes up (a firing or a cascade); -1 if none
+static int TicksUntilNextTimer(const TimerWheel& w) {
+    Uint64 best = 0;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int    shift = WHEEL_BITS * level;
+        Uint64 base  = w.now >> shift;
+        for (int k = 1; k <= WHEEL_SLOTS; k++) {
+            if (w.slots[level][(base + k) & (WHEEL_SLOTS - 1)].empty()) continue;
+            Uint64 ticks = ((base + k) << shift) - w.now;
+            if (!best || ticks < best) best = ticks;
+            break;
+        }
+    }
+    return best ? (int)std::min<Uint64>(best, INT32_MAX) : -1;
+}
+
+static void ClearTimers(TimerWheel& w) {
+    for (auto& level : w.slots)
+        for (auto& slot : level) slot.clear();
+}
+
+void PrintTimerStats(const char* name, const TimerWheel& w) {
+    char buf[200];
+    SDL_snprintf(buf, sizeof(buf), "%s: %llu scheduled, %llu fired, %llu cascaded over %llu ticks\n",
+                 name, (unsigned long long)w.scheduled, (unsigned long long)w.fired,
+                 (unsigned long long)w.cascaded, (unsigned long long)w.now);
+    std::cout << buf;
+}
+
+// ─── Scheduler ────────────────────────────────────────────────────────────────
+// VM state only: this runs on the simulation thread, or directly in tools
+// that drive the VM without one.
+
+struct ScriptScheduler {
+    std::vector<ScriptHandle> tasks;   // per sprite; null when not running
+    TimerWheel                wheel;
+    std::vector<int>          due;     // sprites resumed this tick, ascending
+};
+
+ScriptScheduler scheduler;
+
+static void DestroyTasks() {
+    for (ScriptHandle& h : scheduler.tasks)
+        if (h) h.destroy();
+    scheduler.tasks.clear();
+    ClearTimers(scheduler.wheel);
+}
+
+// Snaps interpolation to the current positions
+static void SettleSprites() {
+    sprites.prevX = sprites.x;
+    sprites.prevY = sprites.y;
+    spritesMoving = false;
+}
+
+static ScriptTask RunScript(int i);
+
+void StartScript() {
+    DestroyTasks();
+    // The last program is dropped wholesale; optimizing only ever shrinks
+    // code, so the block count bounds it
+    ArenaReset(compileArena);
+    program = Program(&compileArena);
+    size_t blocks = 0;
+    for (int i = 0; i < sprites.count; i++) blocks += sprites.scripts[i].size();
+    program.code.reserve(blocks);
+    program.srcIndex.reserve(blocks);
+    runningSprites = 0;
+    Program p(&compileArena);
+    for (int i = 0; i < sprites.count; i++) {
+        const Script& blocks = sprites.scripts[i];
+        int start = (!blocks.empty() && blocks[0].type == EVENT_FLAG) ? 1 : 0;
+        CompileScript(blocks, start, p);
+        if (turboMode) OptimizeProgram(p);
+        LoadSpriteProgram(i, p);
+    }
+    programOptimized = turboMode;
+    ScriptScheduler& sc = scheduler;
+    sc.tasks.assign(sprites.count, nullptr);
+    for (int i = 0; i < sprites.count; i++) {
+        if (sprites.pc[i] >= sprites.codeEnd[i]) continue;
+        sc.tasks[i] = RunScript(i).handle;
+        ScheduleTimer(sc.wheel, sc.wheel.now + 1, i);
+        runningSprites++;
+    }
+    simClock = SDL_GetTicks();
+    simAccum = 0;
+    SettleSprites();
+    rateBlocks = rateCounts = 0;
+}
+
+// Turbo was switched off mid-run. Fused code would play its jumps frame by
+// frame, so each sprite finishes the fused window it is in and goes on with
+// plain code from the same source block.
+static void DeoptimizeProgram() {
+    if (!programOptimized) return;
+    programOptimized = false;
+    SpriteTable& s = sprites;
+    std::vector<int> from(s.count);
+    for (int i = 0; i < s.count; i++) {
+        int end = s.pc[i];
+        while (end > 0 && end < s.codeEnd[i] && program.srcIndex[end] == program.srcIndex[end - 1]) end++;
+        blocksExecuted += ExecSprite(i, end - s.pc[i]);
+        from[i] = SrcPos(i, s.pc[i]);
+    }
+    program = Program(&compileArena);   // the fused code stays in the arena until the next start
+    Program p(&compileArena);
+    for (int i = 0; i < s.count; i++) {
+        CompileScript(s.scripts[i], from[i], p);
+        LoadSpriteProgram(i, p);
+    }
+    SettleSprites();
+}
+
+// Drops every sprite and counter, for tools that run one project after another
+void ResetVm() {
+    DestroyTasks();
+    sprites = SpriteTable{};
+    program = Program{};
+    programOptimized = false;
+    runningSprites = 0;
+    spritesMoving  = false;
+    blocksExecuted = 0;
+    rateBlocks = rateCounts = 0;
+    blocksPerSecond = 0.0;
+}
+
+void StopScript() {
+    DestroyTasks();
+    for (int i = 0; i < sprites.count; i++) sprites.pc[i] = sprites.codeEnd[i];
+    runningSprites = 0;
+    SettleSprites();
+}
+
+// Sprites per parallel chunk; a multiple of 64 so chunks never share a word
+// of the visibility bitset.
+static const int SPRITE_CHUNK = 4096;
+
+// Per-chunk results, reduced in chunk order so totals are deterministic
+struct ChunkResult {
+    Uint64 retired;
+    int    ticked;
+};
+
+std::vector<ChunkResult> chunkResults;
+
+static int SpriteChunks() {
+    int n = (sprites.count + SPRITE_CHUNK - 1) / SPRITE_CHUNK;
+    chunkResults.assign(n, ChunkResult{});
+    return n;
+}
+
+// Returns whether any sprite executed
+static bool ReduceChunks() {
+    int ticked = 0;
+    for (const ChunkResult& c : chunkResults) {
+        blocksExecuted += c.retired;
+        ticked         += c.ticked;
+    }
+    return ticked > 0;
+}
+
+// Resumes the due sprites in chunk c (due is sorted, so they are contiguous)
+static void ResumeDue(int c) {
+    ChunkResult& r = chunkResults[c];
+    const std::vector<int>& due = scheduler.due;
+    auto first = std::lower_bound(due.begin(), due.end(), c * SPRITE_CHUNK);
+    auto last  = std::lower_bound(first, due.end(), (c + 1) * SPRITE_CHUNK);
+    for (auto it = first; it != last; ++it) {
+        int i = *it;
+        int before = SrcPos(i, sprites.pc[i]);
+        scheduler.tasks[i].resume();
+        r.retired += SrcPos(i, sprites.pc[i]) - before;
+        r.ticked++;
+    }
+}
+
+// Pops this tick's due sprites off the wheel
+static void CollectDue() {
+    ScriptScheduler& sc = scheduler;
+    sc.due.clear();
+    AdvanceTimers(sc.wheel, sc.due);
+    std::sort(sc.due.begin(), sc.due.end());   // chunking and determinism
+}
+
+// Re-parks the sprites resumed this tick, or retires finished scripts
+static void RescheduleDue() {
+    ScriptScheduler& sc = scheduler;
+    for (int i : sc.due) {
+        ScriptHandle& h = sc.tasks[i];
+        if (h.done()) {
+            h.destroy();
+            h = nullptr;
+            runningSprites--;
+        } else {
+            ScheduleTimer(sc.wheel, sc.wheel.now + h.promise().sleep, i);
+        }
+    }
+}
+
+// Turns sprite i's instruction into its motion lanes. Reads prevX/prevY,
+// which hold the current positions once a tick has swapped the buffers.
+static void DecodeInstr(int i, const Instr& in) {
+    SpriteTable& s = sprites;
+    MotionLanes& l = lanes;
+    switch (in.op) {
+        case OP_CHANGE_X: l.addX[i] =  (float)in.arg; break;
+        case OP_CHANGE_Y: l.addY[i] = -(float)in.arg; break;
+        case OP_SET_X:    l.keepX[i] = 0; l.addX[i] = (STAGE_W / 2.0f) + in.arg; break;
+        case OP_SET_Y:    l.keepY[i] = 0; l.addY[i] = (STAGE_H / 2.0f) - in.arg; break;
+        case OP_SHOW:     SetVisible(i, true);  break;
+        case OP_HIDE:     SetVisible(i, false); break;
+        case OP_MOVE_X: {   // fused runs; only met if turbo code is run plain
+            const ClampAdd& m = program.moves[in.arg];
+            l.keepX[i] = 0;
+            l.addX[i]  = (float)std::max((double)m.lo, std::min((double)m.hi, s.prevX[i] + m.d));
+            break;
+        }
+        case OP_MOVE_Y: {
+            const ClampAdd& m = program.moves[in.arg];
+            l.keepY[i] = 0;
+            l.addY[i]  = (float)std::max((double)m.lo, std::min((double)m.hi, s.prevY[i] + m.d));
+            break;
+        }
+        default: break;
+    }
+}
+
+// Instructions per resume in turbo, before a script yields to the others
+static const int TURBO_SLICE = 4096;
+
+// One script. Normally it decodes one instruction per tick into the motion
+// lanes (the tick applies every sprite's lanes together afterwards); a wait
+// sleeps in the timer wheel instead. In turbo it runs slices back to back
+// and waits are skipped, like STEP_DELAY.
+static ScriptTask RunScript(int i) {
+    SpriteTable& s = sprites;
+    while (s.pc[i] < s.codeEnd[i]) {
+        if (turboMode) {
+            ExecSprite(i, TURBO_SLICE);
+            if (s.pc[i] < s.codeEnd[i]) co_await NextTick{};
+            continue;
+        }
+        const Instr& in = program.code[s.pc[i]];
+        if (in.op == OP_WAIT) {
+            if (in.arg > 0) co_await Sleep{in.arg};
+            s.pc[i]++;
+            continue;
+        }
+        DecodeInstr(i, in);
+        s.pc[i]++;
+        if (s.pc[i] < s.codeEnd[i]) co_await NextTick{};
+    }
+}
+
+// Resumes chunk c's due scripts into lanes, then writes the new positions
+// into x/y from prevX/prevY.
+static void StepChunk(int c) {
+    SpriteTable& s = sprites;
+    MotionLanes& l = lanes;
+    int begin = c * SPRITE_CHUNK;
+    int end   = std::min(s.count, begin + SPRITE_CHUNK);
+    std::fill(&l.keepX[begin], &l.keepX[begin] + (end - begin), 1.0f);
+    std::fill(&l.addX[begin],  &l.addX[begin]  + (end - begin), 0.0f);
+    std::fill(&l.keepY[begin], &l.keepY[begin] + (end - begin), 1.0f);
+    std::fill(&l.addY[begin],  &l.addY[begin]  + (end - begin), 0.0f);
+    ResumeDue(c);
+    int n = end - begin;
+    motionKernel(&s.x[begin], &s.prevX[begin], &l.keepX[begin], &l.addX[begin], n, 30.0f, STAGE_W - 30.0f);
+    motionKernel(&s.y[begin], &s.prevY[begin], &l.keepY[begin], &l.addY[begin], n, 30.0f, STAGE_H - 30.0f);
+}
+
+// One interpreter tick: every due script runs one instruction. Returns false
+// if nothing was due. Positions are double-buffered: the tick reads
+// prevX/prevY and writes x/y, so no sprite ever sees another's half-updated
+// state, and the swap is O(1).
+static bool StepScript() {
+    SpriteTable& s = sprites;
+    MotionLanes& l = lanes;
+    CollectDue();
+    if (scheduler.due.empty()) {   // everyone is asleep
+        if (spritesMoving) SettleSprites();
+        return false;
+    }
+    l.keepX.resize(s.count);  l.addX.resize(s.count);
+    l.keepY.resize(s.count);  l.addY.resize(s.count);
+    s.prevX.swap(s.x);
+    s.prevY.swap(s.y);
+    ParallelFor(SpriteChunks(), StepChunk);
+    spritesMoving = ReduceChunks();
+    RescheduleDue();
+    return true;
+}
+
+static void UpdateBlockRate(Uint64 blocks, Uint64 counts) {
+    rateBlocks += blocks;
+    rateCounts += counts;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    // Refresh a few times a second, and once more when the run ends
+    if (rateCounts > 0 && (rateCounts >= freq / 4 || runningSprites == 0)) {
+        blocksPerSecond = rateBlocks * (double)freq / rateCounts;
+        rateBlocks = rateCounts = 0;
+    }
+}
+
+// Executes blocks until every script ends or the budget is spent
+static void RunTurbo() {
+    Uint64 freq   = SDL_GetPerformanceFrequency();
+    Uint64 start  = SDL_GetPerformanceCounter();
+    Uint64 budget = (Uint64)(freq * TURBO_BUDGET_MS / 1000.0);
+    Uint64 before = blocksExecuted;
+    while (runningSprites > 0) {
+        CollectDue();
+        ParallelFor(SpriteChunks(), ResumeDue);
+        ReduceChunks();
+        RescheduleDue();
+        if (SDL_GetPerformanceCounter() - start >= budget) break;
+    }
+    UpdateBlockRate(blocksExecuted - before, SDL_GetPerformanceCounter() - start);
+    SettleSprites();
+}
+
+// Fixed-timestep driver: runs as many ticks as the elapsed time calls for,
+// independent of how often it is called. Returns whether sprite state changed.
+bool UpdateScript() {
+    Uint32 now = SDL_GetTicks();
+    Uint32 dt  = now - simClock;
+    simClock = now;
+    if (runningSprites == 0 && !spritesMoving) return false;
+    if (turboMode && runningSprites > 0) { RunTurbo(); return true; }
+
+    bool changed = false;
+    simAccum += dt;
+    int ticks = 0;
+    while (runningSprites > 0 && simAccum >= (Uint32)STEP_DELAY) {
+        if (ticks == MAX_CATCHUP_TICKS) { simAccum = 0; break; }
+        bool wasMoving = spritesMoving;
+        if (StepScript()) ticks++;   // ticks where everyone sleeps are free
+        simAccum -= STEP_DELAY;
+        changed |= ticks > 0 || wasMoving;
+    }
+    // Scripts finished: let the last move play out, then settle
+    if (runningSprites == 0 && simAccum >= (Uint32)STEP_DELAY) {
+        SettleSprites();
+        simAccum = 0;
+        changed  = true;
+    }
+    return changed;
+}
+
+// Milliseconds until UpdateScript has a tick to run: 0 = now, -1 = idle.
+// While every script sleeps this skips straight to the next timer.
+static int NextTickTimeout() {
+    if (turboMode && runningSprites > 0) return 0;
+    if (runningSprites == 0 && !spritesMoving) return -1;
+    Uint64 ticks = 1;
+    if (runningSprites > 0 && !spritesMoving)
+        ticks = std::max(1, TicksUntilNextTimer(scheduler.wheel));
+    Uint64 wait    = ticks * STEP_DELAY;
+    Uint64 pending = simAccum + (SDL_GetTicks() - simClock);
+    return pending >= wait ? 0 : (int)std::min<Uint64>(wait - pending, INT32_MAX);
+}
 
-std::vector<Block> palette;
-std::vector<PaletteHeader> catHeaders;
-std::vector<Block> workspace;
+// ─── Simulation Thread ────────────────────────────────────────────────────────
+// The VM runs on its own thread, so a slow frame never stalls scripts and a
+// heavy script never stalls the UI. The editor sends it commands through a
+// queue; the VM publishes sprite state through a lock-free triple buffer, so
+// neither side waits on the other and the renderer never sees a torn tick.
+enum SimCommandType { CMD_START, CMD_STOP, CMD_SET_TURBO, CMD_ADD_SPRITE, CMD_SET_SCRIPT, CMD_QUIT };
+
+struct SimCommand {
+    SimCommandType     type;
+    int                sprite = 0;
+    float              x = 0, y = 0;
+    bool               flag   = false;
+    std::vector<Block> blocks = {};
+};
 
-// Drag
-bool  dragging        = false;
-Block dragBlock       = {};
-int   dragOffX        = 0, dragOffY = 0;
-bool  dragFromPalette = false;
-int   dragWorkspaceIdx = -1;
+static const int SNAPSHOT_FRESH = 4;   // flag on `latest` until the editor takes it
+static const size_t SPARE_BLOCK_BUFFERS = 16;
 
-// Edit
-bool  editingValue = false;
-int   editingIdx   = -1;
-std::string inputBuffer;
+struct TripleBuffer {
+    SpriteSnapshot   slots[3];
+    std::atomic<int> latest{0};   // last published slot
+    int              back  = 1;   // VM's slot
+    int              front = 2;   // editor's slot
+};
 
-// Script
-bool   scriptRunning = false;
-int    scriptStep    = 0;
-Uint32 lastStepTime  = 0;
-static const int STEP_DELAY = 400;
+struct Simulation {
+    std::thread             thread;
+    std::mutex              m;
+    std::condition_variable cv;
+    std::deque<SimCommand>  commands;
+    std::vector<std::vector<Block>> spareBlocks;   // command buffers the VM is done with
+    TripleBuffer            snapshots;
+    Uint32                  wakeEvent = (Uint32)-1;   // pushed to the editor on publish
+    std::atomic<bool>       wakePending{false};
+};
 
-// ─── Draw Helpers ─────────────────────────────────────────────────────────────
-static void FillCircle(SDL_Renderer* r, int cx, int cy, int radius) {
-    for (int dy = -radius; dy <= radius; dy++) {
-        int dx = (int)std::sqrt((double)(radius*radius - dy*dy));
-        SDL_RenderDrawLine(r, cx - dx, cy + dy, cx + dx, cy + dy);
+Simulation sim;
+
+void PostCommand(SimCommand cmd) {
+    {
+        std::lock_guard<std::mutex> lock(sim.m);
+        sim.commands.push_back(std::move(cmd));
     }
+    sim.cv.notify_one();
 }
 
-static void DrawRoundRect(SDL_Renderer* r, SDL_Rect rect, SDL_Color col, int radius = 6) {
-    SDL_SetRenderDrawColor(r, col.r, col.g, col.b, col.a);
-    SDL_Rect body = {rect.x + radius, rect.y, rect.w - 2*radius, rect.h};
-    SDL_RenderFillRect(r, &body);
-    SDL_Rect bodyV = {rect.x, rect.y + radius, rect.w, rect.h - 2*radius};
-    SDL_RenderFillRect(r, &bodyV);
-    FillCircle(r, rect.x + radius,           rect.y + radius,           radius);
-    FillCircle(r, rect.x + rect.w - radius,  rect.y + radius,           radius);
-    FillCircle(r, rect.x + radius,           rect.y + rect.h - radius,  radius);
-    FillCircle(r, rect.x + rect.w - radius,  rect.y + rect.h - radius,  radius);
+static void PublishSnapshot() {
+    TripleBuffer&   tb = sim.snapshots;
+    SpriteSnapshot& s  = tb.slots[tb.back];
+    s.count   = sprites.count;
+    s.x       = sprites.x;
+    s.y       = sprites.y;
+    s.prevX   = sprites.prevX;
+    s.prevY   = sprites.prevY;
+    s.visible = sprites.visible;
+    s.step.resize(sprites.count);
+    for (int i = 0; i < sprites.count; i++)
+        s.step[i] = sprites.pc[i] < sprites.codeEnd[i] ? program.srcIndex[sprites.pc[i]] : -1;
+    s.tickTime = simClock - simAccum;
+    s.running  = runningSprites > 0;
+    s.turbo    = turboMode;
+    s.blocksPerSecond = blocksPerSecond;
+    tb.back = tb.latest.exchange(tb.back | SNAPSHOT_FRESH) & 3;
+    if (sim.wakeEvent != (Uint32)-1 && !sim.wakePending.exchange(true)) {
+        SDL_Event e{};
+        e.type = sim.wakeEvent;
+        SDL_PushEvent(&e);
+    }
 }
 
-static void DrawText(SDL_Renderer* r, TTF_Font* f, const char* text, int x, int y, SDL_Color col) {
-    if (!f) return;
-    SDL_Surface* surf = TTF_RenderUTF8_Blended(f, text, col);
-    if (!surf) return;
-    SDL_Texture* tex = SDL_CreateTextureFromSurface(r, surf);
-    SDL_Rect dst{x, y, surf->w, surf->h};
-    SDL_FreeSurface(surf);
-    if (!tex) return;
-    SDL_RenderCopy(r, tex, nullptr, &dst);
-    SDL_DestroyTexture(tex);
+// The newest snapshot if one arrived since the last call, else null
+static SpriteSnapshot* AcquireSnapshot() {
+    TripleBuffer& tb = sim.snapshots;
+    if (!(tb.latest.load() & SNAPSHOT_FRESH)) return nullptr;
+    tb.front = tb.latest.exchange(tb.front) & 3;
+    return &tb.slots[tb.front];
 }
 
-static int TextW(TTF_Font* f, const char* text) {
-    int w = 0, h = 0;
-    if (f) TTF_SizeUTF8(f, text, &w, &h);
-    return w;
+// Returns false on CMD_QUIT
+static bool ApplyCommand(SimCommand& c) {
+    switch (c.type) {
+        case CMD_START:
+            if (runningSprites == 0) StartScript();
+            break;
+        case CMD_STOP:
+            StopScript();
+            break;
+        case CMD_SET_TURBO:
+            turboMode = c.flag;
+            if (!turboMode) DeoptimizeProgram();
+            simClock  = SDL_GetTicks();
+            simAccum  = 0;
+            break;
+        case CMD_ADD_SPRITE:
+            sprites.scripts[AddSprite(c.x, c.y, c.flag)].assign(c.blocks.begin(), c.blocks.end());
+            break;
+        case CMD_SET_SCRIPT:
+            if (c.sprite < sprites.count) sprites.scripts[c.sprite].assign(c.blocks.begin(), c.blocks.end());
+            break;
+        case CMD_QUIT:
+            return false;
+    }
+    return true;
 }
 
-static int TextH(TTF_Font* f) {
-    return f ? TTF_FontHeight(f) : 14;
+static void SimMain() {
+    std::deque<SimCommand> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(sim.m);
+            auto ready  = [] { return !sim.commands.empty(); };
+            int timeout = NextTickTimeout();
+            if (timeout < 0)      sim.cv.wait(lock, ready);
+            else if (timeout > 0) sim.cv.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+            batch.swap(sim.commands);
+        }
+        bool changed = !batch.empty();
+        for (SimCommand& c : batch)
+            if (!ApplyCommand(c)) return;
+        // Scripts were copied into capacity the VM already has; the buffers
+        // go back to the editor so an edit allocates on neither side
+        {
+            std::lock_guard<std::mutex> lock(sim.m);
+            for (SimCommand& c : batch)
+                if (c.blocks.capacity() && sim.spareBlocks.size() < SPARE_BLOCK_BUFFERS)
+                    sim.spareBlocks.push_back(std::move(c.blocks));
+        }
+        batch.clear();
+        if (UpdateScript()) changed = true;
+        if (changed) PublishSnapshot();
+    }
 }
 
-static SDL_Rect DrawValuePill(SDL_Renderer* r, int rx, int ry, int rw, int rh,
-                               int value, bool editing, const std::string& buf) {
-    const int PW = 46, PH = 22;
-    int px = rx + rw - PW - 8;
-    int py = ry + (rh - PH) / 2;
-    SDL_SetRenderDrawColor(r, 255, 255, 255, 240);
-    DrawRoundRect(r, {px, py, PW, PH}, {255,255,255,240}, 10);
-    SDL_SetRenderDrawColor(r, 0, 0, 0, 60);
-    SDL_Rect pillBorder{px, py, PW, PH};
-    SDL_RenderDrawRect(r, &pillBorder);
+void StartSimulation() {
+    sim.wakeEvent = SDL_RegisterEvents(1);
+    PublishSnapshot();
+    sim.thread = std::thread(SimMain);
+}
 
-    std::string display = editing ? buf + "|" : std::to_string(value);
-    SDL_Color tc{30,30,30,255};
-    int tw = TextW(fontSmall, display.c_str());
-    DrawText(r, fontSmall, display.c_str(), px + (PW - tw)/2, py + 3, tc);
-    return {px, py, PW, PH};
+void StopSimulation() {
+    if (!sim.thread.joinable()) return;
+    PostCommand({CMD_QUIT});
+    sim.thread.join();
 }
 
-static void DrawHatNotch(SDL_Renderer* r, SDL_Rect br, SDL_Color col) {
-    SDL_SetRenderDrawColor(r, col.r, col.g, col.b, 255);
-    SDL_Rect bump{br.x + 16, br.y - 12, 50, 16};
-    DrawRoundRect(r, bump, col, 6);
+// Editor side from here on
+
+static void SyncScriptStep() {
+    int s    = selectedSprite;
+    int step = s < shown.count ? shown.step[s] : -1;
+    scriptStep    = step >= 0 ? step : workspace.size;
+    scriptRunning = shown.running;
 }
 
-static void DrawBlock(SDL_Renderer* r, const Block& b, bool highlight,
-                       bool isEditing, const std::string& buf) {
-    SDL_Color c = b.color;
-    if (highlight) {
-        c.r = (Uint8)std::min(255, (int)c.r + 50);
-        c.g = (Uint8)std::min(255, (int)c.g + 50);
-        c.b = (Uint8)std::min(255, (int)c.b + 50);
-    }
-    if (b.isHat) DrawHatNotch(r, b.rect, c);
-    DrawRoundRect(r, b.rect, c, 6);
-    SDL_SetRenderDrawColor(r, 0, 0, 0, 50);
-    SDL_Rect shadow{b.rect.x+2, b.rect.y+2, b.rect.w, b.rect.h};
-    SDL_RenderDrawRect(r, &shadow);
+// Fraction of the current tick that has elapsed, for drawing between ticks
+static float SimAlpha() {
+    return std::min(1.0f, (SDL_GetTicks() - shown.tickTime) / (float)STEP_DELAY);
+}
 
-    SDL_Color textCol{255, 255, 255, 255};
-    const char* label = "";
-    switch (b.type) {
-        case EVENT_FLAG: label = "When Flag Clicked"; break;
-        case CHANGE_X:   label = "Change X by";       break;
-        case CHANGE_Y:   label = "Change Y by";       break;
-        case SET_X:      label = "Set X to";          break;
-        case SET_Y:      label = "Set Y to";          break;
-        case LOOKS_SHOW: label = "Show";              break;
-        case LOOKS_HIDE: label = "Hide";              break;
+// Swaps in the newest snapshot, if any, and marks whatever it changed
+void ConsumeSimulation() {
+    sim.wakePending = false;
+    if (SpriteSnapshot* next = AcquireSnapshot()) {
+        const SpriteSnapshot& a = shown;
+        const SpriteSnapshot& b = *next;
+        SDL_Rect box{};
+        bool any = false, moving = false;
+        for (int i = 0; i < b.count; i++) {
+            if (b.prevX[i] != b.x[i] || b.prevY[i] != b.y[i]) moving = true;
+            bool known = i < a.count;
+            if (known && a.x[i] == b.x[i] && a.y[i] == b.y[i] && a.prevX[i] == b.prevX[i] &&
+                a.prevY[i] == b.prevY[i] && TestBit(a.visible, i) == TestBit(b.visible, i)) continue;
+            if (known) {
+                GrowBox(box, any, a.prevX[i], a.prevY[i]);
+                GrowBox(box, any, a.x[i],     a.y[i]);
+            }
+            GrowBox(box, any, b.prevX[i], b.prevY[i]);
+            GrowBox(box, any, b.x[i],     b.y[i]);
+        }
+        if (any) MarkDirty(box);
+        if (any || a.count != b.count || a.turbo != b.turbo || a.blocksPerSecond != b.blocksPerSecond) {
+            MarkSpriteInfoDirty();
+            MarkDirty({STAGE_X + 210, STAGE_Y + STAGE_H + 50, 90, 36});   // TURBO button
+        }
+        int  oldStep    = scriptStep;
+        bool oldRunning = scriptRunning;
+        std::swap(shown, *next);
+        shownMoving = moving;
+        SyncScriptStep();
+        if (scriptStep != oldStep || scriptRunning != oldRunning) {
+            MarkBlockDirty(WorkspaceBlockAt(oldStep));
+            MarkBlockDirty(WorkspaceBlockAt(scriptStep));
+        }
     }
-    int th = TextH(font);
-    int lx = b.rect.x + 12;
-    int ly = b.rect.y + (b.rect.h - th) / 2;
-    DrawText(r, font, label, lx, ly, textCol);
-
-    if (b.type == CHANGE_X || b.type == CHANGE_Y || b.type == SET_X || b.type == SET_Y) {
-        DrawValuePill(r, b.rect.x, b.rect.y, b.rect.w, b.rect.h, b.steps, isEditing, buf);
+    if (shownMoving) {
+        MarkSpritePathsDirty();
+        if (SimAlpha() >= 1.0f) shownMoving = false;   // this frame lands on the tick
     }
 }
 
-// ─── Engine (All blocks visible at once) ──────────────────────────────────────
-void BuildPalette() {
-    palette.clear();
-    catHeaders.clear();
-    
-    int x = 25;
-    int y = 20;
+// Milliseconds until the main loop has work to do without new input:
+// 0 = now, -1 = nothing scheduled (sleep until an event arrives; the
+// simulation thread sends one whenever it publishes).
+int NextWakeTimeout() {
+    if (!damage.rects.empty() || damage.present) return 0;
+    if (!shownMoving) return -1;
+    Uint32 since = SDL_GetTicks() - lastFrameTime;
+    return since >= (Uint32)FRAME_MS ? 0 : (int)(FRAME_MS - since);
+}
 
-    auto addHeader = [&](std::string name) {
-        catHeaders.push_back({name, y});
-        y += 35; 
-    };
+// An empty command buffer, reusing one the VM handed back
+static std::vector<Block> BlockBuffer() {
+    std::vector<Block> buf;
+    std::lock_guard<std::mutex> lock(sim.m);
+    if (!sim.spareBlocks.empty()) {
+        buf.swap(sim.spareBlocks.back());
+        sim.spareBlocks.pop_back();
+    }
+    return buf;
+}
 
-    auto mk = [&](BlockType t, BlockCategory bc, SDL_Color col, bool hat, int defaultVal) {
-        Block b;
-        b.rect     = {x, y, BLOCK_W, hat ? BLOCK_H + 12 : BLOCK_H};
-        b.category = bc;
-        b.type     = t;
-        b.color    = col;
-        b.steps    = defaultVal;
-        b.isHat    = hat;
-        if (hat) b.rect.y += 14;
-        palette.push_back(b);
-        y += b.rect.h + BLOCK_GAP + (hat ? 14 : 0);
-    };
+// Sends the edited script to the VM
+static void SendWorkspace() {
+    SimCommand c{CMD_SET_SCRIPT};
+    c.sprite = selectedSprite;
+    c.blocks = BlockBuffer();
+    CopyBlocks(workspace, c.blocks);
+    PostCommand(std::move(c));
+}
 
-    // 1. Events
-    addHeader("Events");
-    mk(EVENT_FLAG, BCAT_EVENT, COL_EVENTS, true, 0);
-    y += 15;
+static int NewSprite(float x, float y, bool visible, int textureId, const std::vector<Block>& script) {
+    int i = AddSpriteEntry("Sprite" + std::to_string(spriteList.count + 1), textureId);
+    if (i != selectedSprite) AppendBlocks(spriteList.scripts[i], script.begin(), script.end());
+    SimCommand c{CMD_ADD_SPRITE};
+    c.x      = x;
+    c.y      = y;
+    c.flag   = visible;
+    c.blocks = BlockBuffer();
+    c.blocks.assign(script.begin(), script.end());
+    PostCommand(std::move(c));
+    return i;
+}
 
-    // 2. Motion
-    addHeader("Motion");
-    mk(CHANGE_X, BCAT_MOTION, COL_MOTION, false, 10);
-    mk(CHANGE_Y, BCAT_MOTION, COL_MOTION, false, 10);
-    mk(SET_X,    BCAT_MOTION, COL_MOTION, false, 0);
-    mk(SET_Y,    BCAT_MOTION, COL_MOTION, false, 0);
-    y += 15;
+// Swaps the edited script: the old selection's blocks go back to the list
+void SelectSprite(int i) {
+    if (i < 0 || i >= spriteList.count || i == selectedSprite) return;
+    if (editingValue) { editingValue = false; SDL_StopTextInput(); }
+    std::swap(spriteList.scripts[selectedSprite], workspace);
+    std::swap(workspace, spriteList.scripts[i]);
+    selectedSprite = i;
+    view.scroll    = 0;
+    LayoutWorkspace();
+    SyncScriptStep();
+    MarkDirty({SCRIPTS_X, 0, SCRIPTS_W, WINDOW_H});
+    MarkDirty({STAGE_X,   0, STAGE_W,   WINDOW_H});
+}
 
-    // 3. Looks
-    addHeader("Looks");
-    mk(LOOKS_SHOW, BCAT_LOOKS, COL_LOOKS, false, 0);
-    mk(LOOKS_HIDE, BCAT_LOOKS, COL_LOOKS, false, 0);
+// Copies sprite src (state and script) n times, for particle-style demos
+void DuplicateSprite(int src, int n) {
+    bool  known = src < shown.count;
+    float x = known ? shown.x[src] : STAGE_W / 2.0f;
+    float y = known ? shown.y[src] : STAGE_H / 2.0f;
+    std::vector<Block> script;
+    CopyBlocks(ScriptOf(src), script);
+    for (int k = 0; k < n; k++)
+        NewSprite(x, y, ShownVisible(src), spriteList.textureId[src], script);
+    MarkDirty({STAGE_X, 0, STAGE_W, WINDOW_H});
 }
 
-void LayoutWorkspace() {
-    int yy = 60;
-    for (auto& b : workspace) {
-        b.rect.x = SCRIPTS_X + 20;
-        b.rect.y = yy;
-        b.rect.w = BLOCK_W + 20; // Slightly wider in workspace
-        b.rect.h = b.isHat ? BLOCK_H + 12 : BLOCK_H;
-        if (b.isHat) { b.rect.y += 14; yy += 14; }
-        yy += b.rect.h + BLOCK_GAP;
+// Fills an editor that has no sprites yet; the first sprite is selected
+void OpenProject(const Project& p) {
+    for (const ProjectSprite& sp : p.sprites) {
+        std::vector<Block> script(sp.script.begin(), sp.script.end());
+        int i = NewSprite(sp.x, sp.y, sp.visible, 0, script);
+        spriteList.name[i] = sp.name;
+        if (i == selectedSprite) AppendBlocks(workspace, script.begin(), script.end());
     }
+    LayoutWorkspace();
+    MarkAllDirty();
 }
 
-void StartScript() {
-    scriptRunning = true;
-    scriptStep    = 0;
-    lastStepTime  = SDL_GetTicks();
-    if (!workspace.empty() && workspace[0].type == EVENT_FLAG)
-        scriptStep = 1;
+// The editor's sprites as a project, placed where they are on screen
+Project EditorProject() {
+    Project p;
+    for (int i = 0; i < spriteList.count; i++) {
+        ProjectSprite sp;
+        sp.name    = spriteList.name[i];
+        sp.x       = i < shown.count ? shown.x[i] : STAGE_W / 2.0f;
+        sp.y       = i < shown.count ? shown.y[i] : STAGE_H / 2.0f;
+        sp.visible = ShownVisible(i);
+        CopyBlocks(ScriptOf(i), sp.script);
+        p.sprites.push_back(std::move(sp));
+    }
+    return p;
 }
 
-void UpdateScript() {
-    if (!scriptRunning) return;
-    if (scriptStep >= (int)workspace.size()) { scriptRunning = false; return; }
-    Uint32 now = SDL_GetTicks();
-    if (now - lastStepTime < (Uint32)STEP_DELAY) return;
-    lastStepTime = now;
+// ─── Background Layers ────────────────────────────────────────────────────────
+// The scripts grid and the stage grid never change, so they are rendered once
+// into target textures and blitted each frame. Rebuilt after a resize, a theme
+// change or a render-target reset (which loses target texture contents).
+struct BackgroundLayers {
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture*  scripts  = nullptr;
+    SDL_Texture*  stage    = nullptr;
+    bool          valid    = false;
+};
 
-    Block& b = workspace[scriptStep];
-    switch (b.type) {
-        case CHANGE_X:   spriteX += b.steps; break;
-        case CHANGE_Y:   spriteY -= b.steps; break; 
-        case SET_X:      spriteX = (STAGE_W / 2.0f) + b.steps; break;
-        case SET_Y:      spriteY = (STAGE_H / 2.0f) - b.steps; break;
-        case LOOKS_SHOW: spriteVisible = true;  break;
-        case LOOKS_HIDE: spriteVisible = false; break;
-        default: break;
-    }
-    spriteX = std::max(30.0f, std::min((float)STAGE_W - 30, spriteX));
-    spriteY = std::max(30.0f, std::min((float)STAGE_H - 30, spriteY));
-    scriptStep++;
-    if (scriptStep >= (int)workspace.size()) scriptRunning = false;
+BackgroundLayers backgrounds;
+
+static void DrawScriptsBackground(SDL_Renderer* r, int ox, int oy) {
+    SDL_SetRenderDrawColor(r, 240, 240, 248, 255);
+    SDL_Rect bg{ox, oy, SCRIPTS_W, WINDOW_H};
+    SDL_RenderFillRect(r, &bg);
+    std::vector<SDL_Point> dots;
+    for (int gx = 20; gx < SCRIPTS_W; gx += 20)
+        for (int gy = 20; gy < WINDOW_H; gy += 20)
+            dots.push_back({ox + gx, oy + gy});
+    SDL_SetRenderDrawColor(r, 225, 225, 235, 255);
+    SDL_RenderDrawPoints(r, dots.data(), (int)dots.size());
 }
 
-// ─── Panels ───────────────────────────────────────────────────────────────────
-void DrawStage(SDL_Renderer* r) {
+static void DrawStageBackground(SDL_Renderer* r, int ox, int oy) {
     SDL_SetRenderDrawColor(r, 255, 255, 255, 255);
-    SDL_Rect stageRect{STAGE_X, STAGE_Y, STAGE_W, STAGE_H};
+    SDL_Rect stageRect{ox, oy, STAGE_W, STAGE_H};
     SDL_RenderFillRect(r, &stageRect);
-
-    SDL_SetRenderDrawColor(r, 220, 220, 230, 255);
+    std::vector<SDL_Point> dots;
     for (int gx = 40; gx < STAGE_W; gx += 40)
         for (int gy = 40; gy < STAGE_H; gy += 40)
-            SDL_RenderDrawPoint(r, STAGE_X + gx, STAGE_Y + gy);
-
+            dots.push_back({ox + gx, oy + gy});
+    SDL_SetRenderDrawColor(r, 220, 220, 230, 255);
+    SDL_RenderDrawPoints(r, dots.data(), (int)dots.size());
     SDL_SetRenderDrawColor(r, 180, 180, 200, 255);
     SDL_RenderDrawRect(r, &stageRect);
+}
 
-    if (spriteVisible) {
-        int sw = 70, sh = 70;
-        int sx = STAGE_X + (int)spriteX - sw/2;
-        int sy = STAGE_Y + (int)spriteY - sh/2;
-        SDL_Rect dst{sx, sy, sw, sh};
-        if (spriteTexture) {
-            SDL_RenderCopy(r, spriteTexture, nullptr, &dst);
-        } else {
-            int cx = STAGE_X + (int)spriteX;
-            int cy = STAGE_Y + (int)spriteY;
-            SDL_SetRenderDrawColor(r, 255, 140, 60, 255);
-            FillCircle(r, cx, cy, 28);
-            SDL_SetRenderDrawColor(r, 255, 120, 40, 255);
-            for (int i = 0; i < 3; i++) {
-                SDL_RenderDrawLine(r, cx - 18, cy - 22 + i, cx - 10, cy - 30 + i);
-                SDL_RenderDrawLine(r, cx + 18, cy - 22 + i, cx + 10, cy - 30 + i);
-            }
-            SDL_SetRenderDrawColor(r, 255, 255, 255, 255);
-            FillCircle(r, cx - 10, cy - 8, 6);
-            FillCircle(r, cx + 10, cy - 8, 6);
-            SDL_SetRenderDrawColor(r, 30, 30, 30, 255);
-            FillCircle(r, cx - 9, cy - 8, 3);
-            FillCircle(r, cx + 11, cy - 8, 3);
-            SDL_SetRenderDrawColor(r, 255, 100, 130, 255);
-            FillCircle(r, cx, cy + 2, 3);
-            SDL_SetRenderDrawColor(r, 30, 30, 30, 255);
-            SDL_RenderDrawLine(r, cx - 10, cy + 12, cx, cy + 8);
-            SDL_RenderDrawLine(r, cx + 10, cy + 12, cx, cy + 8);
+static void FreeBackgrounds() {
+    if (backgrounds.scripts) SDL_DestroyTexture(backgrounds.scripts);
+    if (backgrounds.stage)   SDL_DestroyTexture(backgrounds.stage);
+    backgrounds = BackgroundLayers{};
+}
+
+static void InvalidateBackgrounds() { backgrounds.valid = false; }
+
+static SDL_Texture* BakeLayer(SDL_Renderer* r, SDL_Texture* tex, int w, int h,
+                              void (*draw)(SDL_Renderer*, int, int)) {
+    if (!tex) tex = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+    if (!tex) return nullptr;
+    SDL_Texture* prev = SDL_GetRenderTarget(r);
+    if (SDL_SetRenderTarget(r, tex) != 0) { SDL_DestroyTexture(tex); return nullptr; }
+    draw(r, 0, 0);
+    SDL_SetRenderTarget(r, prev);
+    return tex;
+}
+
+static void BuildBackgrounds(SDL_Renderer* r) {
+    if (backgrounds.renderer != r) { FreeBackgrounds(); backgrounds.renderer = r; }
+    backgrounds.scripts = BakeLayer(r, backgrounds.scripts, SCRIPTS_W, WINDOW_H, DrawScriptsBackground);
+    backgrounds.stage   = BakeLayer(r, backgrounds.stage,   STAGE_W,   STAGE_H,  DrawStageBackground);
+    backgrounds.valid   = true;
+}
+
+static void BlitBackground(SDL_Renderer* r, SDL_Texture* BackgroundLayers::*layer,
+                           void (*draw)(SDL_Renderer*, int, int), SDL_Rect dst) {
+    if (!backgrounds.valid || backgrounds.renderer != r) BuildBackgrounds(r);
+    if (SDL_Texture* tex = backgrounds.*layer) SDL_RenderCopy(r, tex, nullptr, &dst);
+    else draw(r, dst.x, dst.y);   // no render-target support: draw directly
+}
+
+// ─── Panels ───────────────────────────────────────────────────────────────────
+static void DrawFallbackSprite(SDL_Renderer* r, int cx, int cy) {
+    SDL_SetRenderDrawColor(r, 255, 140, 60, 255);
+    FillCircle(r, cx, cy, 28);
+    SDL_SetRenderDrawColor(r, 255, 120, 40, 255);
+    for (int i = 0; i < 3; i++) {
+        SDL_RenderDrawLine(r, cx - 18, cy - 22 + i, cx - 10, cy - 30 + i);
+        SDL_RenderDrawLine(r, cx + 18, cy - 22 + i, cx + 10, cy - 30 + i);
+    }
+    SDL_SetRenderDrawColor(r, 255, 255, 255, 255);
+    FillCircle(r, cx - 10, cy - 8, 6);
+    FillCircle(r, cx + 10, cy - 8, 6);
+    SDL_SetRenderDrawColor(r, 30, 30, 30, 255);
+    FillCircle(r, cx - 9, cy - 8, 3);
+    FillCircle(r, cx + 11, cy - 8, 3);
+    SDL_SetRenderDrawColor(r, 255, 100, 130, 255);
+    FillCircle(r, cx, cy + 2, 3);
+    SDL_SetRenderDrawColor(r, 30, 30, 30, 255);
+    SDL_RenderDrawLine(r, cx - 10, cy + 12, cx, cy + 8);
+    SDL_RenderDrawLine(r, cx + 10, cy + 12, cx, cy + 8);
+}
+
+void DrawStage(SDL_Renderer* r) {
+    BlitBackground(r, &BackgroundLayers::stage, DrawStageBackground,
+                   {STAGE_X, STAGE_Y, STAGE_W, STAGE_H});
+
+    // Textured sprites go through one batch; the fallback cat uses lines, so
+    // it is drawn first and unbatched.
+    const SpriteSnapshot& s = shown;
+    float a = SimAlpha();
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) BeginBatch();
+        for (int i = 0; i < s.count; i++) {
+            if (!TestBit(s.visible, i)) continue;
+            SDL_Texture* tex = i < spriteList.count ? SpriteTextureFor(spriteList.textureId[i]) : nullptr;
+            if ((tex != nullptr) != (pass == 1)) continue;
+            float dx = s.prevX[i] + (s.x[i] - s.prevX[i]) * a;
+            float dy = s.prevY[i] + (s.y[i] - s.prevY[i]) * a;
+            int cx = STAGE_X + (int)dx;
+            int cy = STAGE_Y + (int)dy;
+            if (tex) PushQuad(tex, cx - 35, cy - 35, cx + 35, cy + 35, 0, 0, 1, 1, {255, 255, 255, 255});
+            else     DrawFallbackSprite(r, cx, cy);
         }
+        if (pass == 1) EndBatch(r);
     }
 
     SDL_SetRenderDrawColor(r, 248, 248, 252, 255);
@@ -316,49 +3224,89 @@ void DrawStage(SDL_Renderer* r) {
     SDL_SetRenderDrawColor(r, 200, 200, 220, 255);
     SDL_RenderDrawRect(r, &infoBar);
 
-    float scratchX = spriteX - (STAGE_W / 2.0f);
-    float scratchY = (STAGE_H / 2.0f) - spriteY;
+    int   sel      = selectedSprite;
+    bool  known    = sel < s.count;
+    float scratchX = known ? s.x[sel] - (STAGE_W / 2.0f) : 0.0f;
+    float scratchY = known ? (STAGE_H / 2.0f) - s.y[sel] : 0.0f;
     
     char info[100];
-    SDL_snprintf(info, sizeof(info), "X: %.0f   Y: %.0f   %s", 
-                 scratchX, scratchY, spriteVisible ? "Visible" : "Hidden");
+    if (s.turbo)
+        SDL_snprintf(info, sizeof(info), "X: %.0f   Y: %.0f   %s   %.0f blocks/s",
+                     scratchX, scratchY, ShownVisible(sel) ? "Visible" : "Hidden", s.blocksPerSecond);
+    else
+        SDL_snprintf(info, sizeof(info), "X: %.0f   Y: %.0f   %s", 
+                     scratchX, scratchY, ShownVisible(sel) ? "Visible" : "Hidden");
     DrawText(r, fontSmall, info, STAGE_X + 10, STAGE_Y + STAGE_H + 12, {80, 80, 100, 255});
 
     SDL_Rect goBtn{STAGE_X + 10, STAGE_Y + STAGE_H + 50, 90, 36};
     DrawRoundRect(r, goBtn, {0, 200, 80, 255}, 6);
-    DrawText(r, font, "GO", goBtn.x + 32, goBtn.y + 10, {255, 255, 255, 255});
+    DrawLabel(r, font, "GO", goBtn.x + 32, goBtn.y + 10, {255, 255, 255, 255});
     SDL_Rect stopBtn{STAGE_X + 110, STAGE_Y + STAGE_H + 50, 90, 36};
     DrawRoundRect(r, stopBtn, {220, 50, 50, 255}, 6);
-    DrawText(r, font, "STOP", stopBtn.x + 24, stopBtn.y + 10, {255, 255, 255, 255});
+    DrawLabel(r, font, "STOP", stopBtn.x + 24, stopBtn.y + 10, {255, 255, 255, 255});
+    SDL_Rect turboBtn{STAGE_X + 210, STAGE_Y + STAGE_H + 50, 90, 36};
+    DrawRoundRect(r, turboBtn, s.turbo ? SDL_Color{255, 150, 0, 255} : SDL_Color{170, 170, 190, 255}, 6);
+    DrawLabel(r, font, "TURBO", turboBtn.x + 20, turboBtn.y + 10, {255, 255, 255, 255});
+}
+
+// Sprite list: rows scroll whole, and only the rows on screen are drawn, so
+// the cost does not depend on how many sprites exist.
+int spriteListFirst = 0;   // index of the top visible row
+
+static const SDL_Rect ADD_SPRITE_BTN{STAGE_X + STAGE_W - 45,  SPRITE_PANEL_Y + 6, 35, 24};
+static const SDL_Rect DUP_SPRITE_BTN{STAGE_X + STAGE_W - 100, SPRITE_PANEL_Y + 6, 50, 24};
+
+static int SpriteListRows() {
+    return SPRITE_LIST_RECT.h / SPRITE_ROW_H;
+}
+
+static void ScrollSpriteList(int first) {
+    int maxFirst = std::max(0, spriteList.count - SpriteListRows());
+    first = std::max(0, std::min(maxFirst, first));
+    if (first == spriteListFirst) return;
+    spriteListFirst = first;
+    MarkDirty(SPRITE_LIST_RECT);
 }
 
 void DrawSpritePanel(SDL_Renderer* r) {
-    int py = STAGE_Y + STAGE_H + 95;
+    int py = SPRITE_PANEL_Y;
     SDL_SetRenderDrawColor(r, 245, 245, 252, 255);
     SDL_Rect panel{STAGE_X, py, STAGE_W, WINDOW_H - py};
     SDL_RenderFillRect(r, &panel);
     SDL_SetRenderDrawColor(r, 200, 200, 215, 255);
     SDL_RenderDrawLine(r, STAGE_X, py, STAGE_X + STAGE_W, py);
-    DrawText(r, font, "Sprite", STAGE_X + 15, py + 10, {80, 80, 100, 255});
-
-    SDL_SetRenderDrawColor(r, 200, 220, 255, 255);
-    SDL_Rect thumb{STAGE_X + 15, py + 40, 70, 60};
-    DrawRoundRect(r, thumb, {200, 220, 255, 255}, 6);
-    SDL_SetRenderDrawColor(r, 255, 140, 60, 255);
-    FillCircle(r, STAGE_X + 50, py + 70, 18);
-    SDL_SetRenderDrawColor(r, 74, 144, 226, 255);
-    for (int d = 0; d < 2; d++) {
-        SDL_Rect sel{thumb.x - d, thumb.y - d, thumb.w + 2*d, thumb.h + 2*d};
-        SDL_RenderDrawRect(r, &sel);
+    DrawLabel(r, font, "Sprites", STAGE_X + 15, py + 10, {80, 80, 100, 255});
+    char count[16];
+    SDL_snprintf(count, sizeof(count), "(%d)", spriteList.count);
+    DrawText(r, fontSmall, count, STAGE_X + 90, py + 13, {120, 120, 140, 255});
+
+    DrawRoundRect(r, DUP_SPRITE_BTN, {74, 144, 226, 255}, 5);
+    DrawLabel(r, fontSmall, "x100", DUP_SPRITE_BTN.x + 10, DUP_SPRITE_BTN.y + 4, {255, 255, 255, 255});
+    DrawRoundRect(r, ADD_SPRITE_BTN, {74, 144, 226, 255}, 5);
+    DrawLabel(r, font, "+", ADD_SPRITE_BTN.x + 12, ADD_SPRITE_BTN.y + 1, {255, 255, 255, 255});
+
+    const SDL_Rect& list = SPRITE_LIST_RECT;
+    int rows = SpriteListRows();
+    int last = std::min(spriteList.count, spriteListFirst + rows);
+    BeginBatch();
+    for (int i = spriteListFirst; i < last; i++) {
+        int ry = list.y + (i - spriteListFirst) * SPRITE_ROW_H;
+        if (i == selectedSprite)
+            DrawRoundRect(r, {list.x + 8, ry, list.w - 20, SPRITE_ROW_H - 2}, {200, 220, 255, 255}, 5);
+        SDL_SetRenderDrawColor(r, 255, 140, 60, 255);
+        FillCircle(r, list.x + 24, ry + SPRITE_ROW_H / 2 - 1, 9);
+        DrawLabel(r, fontSmall, spriteList.name[i].c_str(), list.x + 42, ry + 5, {80, 80, 120, 255});
+        bool vis = ShownVisible(i);
+        FillRect(r, {list.x + 280, ry + 5, 16, 16}, vis ? SDL_Color{80, 160, 80, 255} : SDL_Color{200, 80, 80, 255});
+        DrawLabel(r, fontSmall, vis ? "Visible" : "Hidden", list.x + 302, ry + 5, {80, 80, 100, 255});
     }
-    DrawText(r, fontSmall, "Sprite1", STAGE_X + 18, py + 104, {80, 80, 120, 255});
-
-    SDL_Rect visBox{STAGE_X + 100, py + 48, 18, 18};
-    SDL_SetRenderDrawColor(r, spriteVisible ? 80 : 200, 
-                              spriteVisible ? 160 : 80, 
-                              spriteVisible ? 80 : 80, 255);
-    SDL_RenderFillRect(r, &visBox);
-    DrawText(r, fontSmall, "Visible", STAGE_X + 122, py + 50, {80, 80, 100, 255});
+    if (spriteList.count > rows) {
+        int thumbH = std::max(12, list.h * rows / spriteList.count);
+        int thumbY = list.y + (list.h - thumbH) * spriteListFirst / (spriteList.count - rows);
+        FillRect(r, {list.x + list.w - 8, list.y, 4, list.h}, {225, 225, 235, 255});
+        FillRect(r, {list.x + list.w - 8, thumbY, 4, thumbH}, {160, 160, 185, 255});
+    }
+    EndBatch(r);
 }
 
 void DrawCategoryPanel(SDL_Renderer* r) {
@@ -368,13 +3316,15 @@ void DrawCategoryPanel(SDL_Renderer* r) {
 
     // Draw Section Headers
     for (const auto& header : catHeaders) {
-        DrawText(r, font, header.name.c_str(), 20, header.yPos, {200, 200, 220, 255});
+        DrawLabel(r, font, header.name.c_str(), 20, header.yPos, {200, 200, 220, 255});
         SDL_SetRenderDrawColor(r, 100, 100, 120, 255);
         SDL_RenderDrawLine(r, 20, header.yPos + 22, CAT_W - 30, header.yPos + 22);
     }
 
     // Draw all blocks in palette
+    BeginBatch();
     for (auto& b : palette) DrawBlock(r, b, false, false, "");
+    EndBatch(r);
 
     // Border
     SDL_SetRenderDrawColor(r, 80, 80, 100, 200);
@@ -382,43 +3332,117 @@ void DrawCategoryPanel(SDL_Renderer* r) {
 }
 
 void DrawScriptsArea(SDL_Renderer* r) {
-    SDL_SetRenderDrawColor(r, 240, 240, 248, 255);
-    SDL_Rect bg{SCRIPTS_X, 0, SCRIPTS_W, WINDOW_H};
-    SDL_RenderFillRect(r, &bg);
-    SDL_SetRenderDrawColor(r, 225, 225, 235, 255);
-    for (int gx = SCRIPTS_X + 20; gx < SCRIPTS_X + SCRIPTS_W; gx += 20)
-        for (int gy = 20; gy < WINDOW_H; gy += 20)
-            SDL_RenderDrawPoint(r, gx, gy);
+    const SDL_Rect area{SCRIPTS_X, 0, SCRIPTS_W, WINDOW_H};
+    SDL_Rect damaged = area;
+    if (SDL_RenderIsClipEnabled(r)) SDL_RenderGetClipRect(r, &damaged);
+    // Blocks clip to whole view units, so the damage widens to every pixel
+    // they can touch and all of it is repainted
+    SDL_Rect blocksClip{}, inside = InsideInView(area), cover = CoverInView(damaged), clip = area;
+    bool blocksShown = SDL_IntersectRect(&cover, &inside, &blocksClip);
+    SDL_Rect widened = ViewToScreen(cover);
+    SDL_IntersectRect(&widened, &area, &clip);
+    SDL_RenderSetClipRect(r, &clip);
+
+    BlitBackground(r, &BackgroundLayers::scripts, DrawScriptsBackground, area);
+
+    SDL_RenderSetScale(r, view.zoom, view.zoom);
+    SDL_RenderSetClipRect(r, &blocksClip);
+    BeginBatch();
+    SDL_Point   o = ViewOrigin();
+    BlockHandle h = blocksShown ? WorkspaceBlockAtY(std::max(blocksClip.y, o.y)) : NO_BLOCK;
+    if (h != NO_BLOCK) {
+        int slot   = blockPool.nodes[h].slot;
+        int i      = FenwickSum(layout.count, slot);
+        int top    = o.y + FenwickSum(layout.extent, slot);
+        int bottom = blocksClip.y + blocksClip.h;
+        for (; h != NO_BLOCK && top < bottom; h = NextBlock(h), i++) {
+            Block& b = BlockAt(h);
+            b.rect   = BlockRectAt(b, o.x, top);
+            top     += BlockExtent(b);
+            bool hi = scriptRunning && (i == scriptStep);
+            bool ed = editingValue && (editingBlock == h);
+            DrawBlock(r, b, hi, ed, ed ? inputBuffer : "");
+        }
+    }
+    EndBatch(r);
+    SDL_RenderSetScale(r, 1, 1);
+    SDL_RenderSetClipRect(r, &clip);
 
+    // Header over blocks scrolled under it
     SDL_SetRenderDrawColor(r, 220, 220, 235, 255);
-    SDL_Rect header{SCRIPTS_X, 0, SCRIPTS_W, 40};
+    SDL_Rect header{SCRIPTS_X, 0, SCRIPTS_W, SCRIPTS_HEADER_H};
     SDL_RenderFillRect(r, &header);
     SDL_SetRenderDrawColor(r, 200, 200, 218, 255);
-    SDL_RenderDrawLine(r, SCRIPTS_X, 40, SCRIPTS_X + SCRIPTS_W, 40);
-    DrawText(r, font, "Scripts Workspace", SCRIPTS_X + 15, 12, {80, 80, 110, 255});
-    
-    for (int i = 0; i < (int)workspace.size(); i++) {
-        bool hi = scriptRunning && (i == scriptStep);
-        bool ed = editingValue && (editingIdx == i);
-        DrawBlock(r, workspace[i], hi, ed, ed ? inputBuffer : "");
+    SDL_RenderDrawLine(r, SCRIPTS_X, SCRIPTS_HEADER_H, SCRIPTS_X + SCRIPTS_W, SCRIPTS_HEADER_H);
+    DrawLabel(r, font, "Scripts Workspace", SCRIPTS_X + 15, 12, {80, 80, 110, 255});
+    if (view.zoomLevel != 0) {
+        char zoom[16];
+        SDL_snprintf(zoom, sizeof(zoom), "%d%%", (int)std::lround(view.zoom * 100));
+        DrawLabel(r, fontSmall, zoom, SCRIPTS_X + SCRIPTS_W - 60, 14, {120, 120, 150, 255});
+    }
+
+    int maxScroll = MaxScroll();
+    if (maxScroll > 0) {
+        int trackY = SCRIPTS_HEADER_H + 4, trackH = WINDOW_H - trackY - 4;
+        int viewH  = (int)((WINDOW_H - WORKSPACE_TOP) / view.zoom);
+        int thumbH = std::max(20, (int)((long long)trackH * viewH / (maxScroll + viewH)));
+        int thumbY = trackY + (int)((long long)(trackH - thumbH) * view.scroll / maxScroll);
+        SDL_SetRenderDrawColor(r, 190, 190, 210, 255);
+        SDL_Rect thumb{SCRIPTS_X + SCRIPTS_W - 9, thumbY, 5, thumbH};
+        SDL_RenderFillRect(r, &thumb);
     }
     
-    if (workspace.empty()) {
+    if (workspace.size == 0) {
         SDL_Color hint{160, 160, 185, 255};
-        DrawText(r, fontSmall, "Drag blocks here to build your script", 
+        DrawLabel(r, fontSmall, "Drag blocks here to build your script", 
                  SCRIPTS_X + 30, WINDOW_H/2 - 10, hint);
     }
     SDL_SetRenderDrawColor(r, 180, 180, 200, 200);
     SDL_RenderDrawLine(r, SCRIPTS_X + SCRIPTS_W - 1, 0, SCRIPTS_X + SCRIPTS_W - 1, WINDOW_H);
 }
 
-void Render(SDL_Renderer* r) {
-    SDL_SetRenderDrawColor(r, 200, 200, 215, 255);
-    SDL_RenderClear(r);
-    DrawCategoryPanel(r);    
-    DrawScriptsArea(r);      
-    DrawStage(r);            
-    DrawSpritePanel(r);      
+void DrawStageColumn(SDL_Renderer* r) {
+    DrawStage(r);
+    DrawSpritePanel(r);
+}
+
+SDL_Texture* backbuffer = nullptr;
+
+// Returns false when there was nothing to redraw or present
+bool Render(SDL_Renderer* r) {
+    if (damage.rects.empty() && !damage.present) return false;
+
+    if (!backbuffer) {
+        backbuffer = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                       WINDOW_W, WINDOW_H);
+        if (backbuffer) SDL_SetTextureBlendMode(backbuffer, SDL_BLENDMODE_NONE);
+        MarkAllDirty();
+    }
+    // Without a backbuffer the window has to be redrawn in full every present
+    bool direct = !backbuffer || SDL_SetRenderTarget(r, backbuffer) != 0;
+    if (direct) MarkAllDirty();
+
+    struct Panel { SDL_Rect area; void (*draw)(SDL_Renderer*); };
+    static const Panel panels[] = {
+        {{0,         0, CAT_W,     WINDOW_H}, DrawCategoryPanel},
+        {{SCRIPTS_X, 0, SCRIPTS_W, WINDOW_H}, DrawScriptsArea},
+        {{STAGE_X,   0, STAGE_W,   WINDOW_H}, DrawStageColumn},
+    };
+    for (const auto& p : panels) {
+        SDL_Rect clip;
+        if (!DamageIn(p.area, clip)) continue;
+        SDL_RenderSetClipRect(r, &clip);
+        SDL_SetRenderDrawColor(r, 200, 200, 215, 255);
+        SDL_RenderFillRect(r, &clip);
+        p.draw(r);
+    }
+    SDL_RenderSetClipRect(r, nullptr);
+    if (!direct) {
+        SDL_SetRenderTarget(r, nullptr);
+        SDL_RenderCopy(r, backbuffer, nullptr, nullptr);
+    }
+
+    // The drag ghost floats above the backbuffer and never damages it
     if (dragging) {
         SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
         SDL_Color c = dragBlock.color;
@@ -428,20 +3452,19 @@ void Render(SDL_Renderer* r) {
         DrawBlock(r, dragBlock, false, false, "");
     }
     SDL_RenderPresent(r);
+    lastFrameTime = SDL_GetTicks();
+    damage.rects.clear();
+    damage.present = false;
+    return true;
 }
 
-// ─── Main ─────────────────────────────────────────────────────────────────────
-int main(int argc, char** argv) {
-    SDL_Init(SDL_INIT_VIDEO);
-    IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
-    TTF_Init();
-
-    SDL_Window* window = SDL_CreateWindow("Scratch Clone - SDL2",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        WINDOW_W, WINDOW_H, SDL_WINDOW_SHOWN);
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1,
-        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+static void FreeBackbuffer() {
+    if (backbuffer) SDL_DestroyTexture(backbuffer);
+    backbuffer = nullptr;
+}
 
+// ─── Resources ────────────────────────────────────────────────────────────────
+void OpenFonts() {
     const char* fontPaths[] = {
         "/usr/share/fonts/truetype/dejavu/DejaVuSans-Bold.ttf",
         "/usr/share/fonts/truetype/liberation/LiberationSans-Bold.ttf",
@@ -456,33 +3479,320 @@ int main(int argc, char** argv) {
         if (!fontSmall) fontSmall = TTF_OpenFont(path, 12);
         if (font && fontSmall) break;
     }
+}
+
+void LoadSpriteTextures(SDL_Renderer* r) {
+    SDL_Texture* spriteTexture = IMG_LoadTexture(r, "sprite.jpg");
+    if (!spriteTexture) spriteTexture = IMG_LoadTexture(r, "sprite.png");
+    spriteTextures.push_back(spriteTexture);   // id 0; null draws the fallback cat
+}
+
+// Everything created against a renderer, plus the fonts
+void FreeRenderResources() {
+    FreeGlyphAtlases();
+    ClearLabelCache();
+    FreeShapeCache();
+    FreeBackgrounds();
+    FreeBackbuffer();
+    for (SDL_Texture* t : spriteTextures) if (t) SDL_DestroyTexture(t);
+    spriteTextures.clear();
+    if (font)      TTF_CloseFont(font);
+    if (fontSmall) TTF_CloseFont(fontSmall);
+    font = fontSmall = nullptr;
+}
+
+// ─── Headless ─────────────────────────────────────────────────────────────────
+// --headless runs projects in turbo on the calling thread, with no window,
+// renderer, fonts or textures, and prints each one's final sprite state.
+// The VM and thread pool are reused across projects.
+int RunHeadless(const std::vector<std::string>& paths) {
+    turboMode = true;
+    Uint64 freq  = SDL_GetPerformanceFrequency();
+    Uint64 total = SDL_GetPerformanceCounter();
+    int failed = 0;
+    Project project;
+    project.arena = &projectArena;
+    std::string err;
+    for (const std::string& path : paths) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        // The last project's scripts go in O(1); the arena's chunks are reused
+        ResetVm();
+        ArenaReset(projectArena);
+        if (!LoadProject(path, project, err)) {
+            std::cerr << err << "\n";
+            failed++;
+            continue;
+        }
+        for (ProjectSprite& sp : project.sprites)
+            sprites.scripts[AddSprite(sp.x, sp.y, sp.visible)] = std::move(sp.script);
+        StartScript();
+        while (runningSprites > 0) RunTurbo();
+        double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / freq;
+
+        char buf[256];
+        SDL_snprintf(buf, sizeof(buf), "%s: %llu blocks in %.3f ms\n",
+                     path.c_str(), (unsigned long long)blocksExecuted, ms);
+        std::cout << buf;
+        for (int i = 0; i < sprites.count; i++) {
+            SDL_snprintf(buf, sizeof(buf), "  %s x=%.0f y=%.0f %s\n", project.sprites[i].name.c_str(),
+                         sprites.x[i] - (STAGE_W / 2.0f), (STAGE_H / 2.0f) - sprites.y[i],
+                         IsVisible(i) ? "visible" : "hidden");
+            std::cout << buf;
+        }
+    }
+    double secs = (SDL_GetPerformanceCounter() - total) / (double)freq;
+    char buf[128];
+    SDL_snprintf(buf, sizeof(buf), "%d projects, %d failed, %.3f s\n", (int)paths.size(), failed, secs);
+    std::cout << buf;
+    PrintArenaStats("project arena", projectArena);
+    PrintArenaStats("compile arena", compileArena);
+    PrintTimerStats("timer wheel", scheduler.wheel);
+    PrintImportStats();
+    return failed ? 1 : 0;
+}
+
+// ─── Thumbnails ───────────────────────────────────────────────────────────────
+// --thumbnails <dir> draws each project's stage, as saved, into a software
+// renderer over a plain surface and writes <dir>/<name>.png; with --full the
+// whole editor is captured instead. No video subsystem is used, and the one
+// renderer with its glyph atlases, label and shape caches serves the batch.
+
+// Puts a project on screen the way the editor would show it after loading
+static void ShowProject(const Project& p) {
+    SpriteSnapshot& s = shown;
+    s = SpriteSnapshot{};
+    s.count = (int)p.sprites.size();
+    s.visible.assign((s.count + 63) / 64, 0);
+    // Every script shown so far goes at once
+    spriteList = SpriteList{};
+    workspace  = BlockList{};
+    ResetBlockPool();
+    for (int i = 0; i < s.count; i++) {
+        const ProjectSprite& sp = p.sprites[i];
+        s.x.push_back(sp.x);
+        s.y.push_back(sp.y);
+        s.step.push_back(-1);
+        if (sp.visible) s.visible[i >> 6] |= 1ull << (i & 63);
+        AddSpriteEntry(sp.name, 0);
+        AppendBlocks(i == 0 ? workspace : spriteList.scripts[i], sp.script.begin(), sp.script.end());
+    }
+    s.prevX = s.x;
+    s.prevY = s.y;
+    shownMoving = false;
+    selectedSprite = 0;
+    spriteListFirst = 0;
+    view = WorkspaceView{};
+    LayoutWorkspace();
+}
+
+static std::string ThumbnailPath(const std::string& dir, const std::string& project) {
+    size_t slash = project.find_last_of("/\\");
+    std::string name = project.substr(slash == std::string::npos ? 0 : slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) name.resize(dot);
+    return dir + "/" + name + ".png";
+}
+
+int RunThumbnails(const std::string& dir, const std::vector<std::string>& paths, bool full) {
+    SDL_Surface* frame = SDL_CreateRGBSurfaceWithFormat(0, WINDOW_W, WINDOW_H, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Surface* thumb = SDL_CreateRGBSurfaceWithFormat(0, STAGE_W, STAGE_H, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Renderer* r = frame ? SDL_CreateSoftwareRenderer(frame) : nullptr;
+    if (!thumb || !r) {
+        std::cerr << "thumbnails: " << SDL_GetError() << "\n";
+        if (frame) SDL_FreeSurface(frame);
+        if (thumb) SDL_FreeSurface(thumb);
+        return 1;
+    }
+    SDL_SetSurfaceBlendMode(frame, SDL_BLENDMODE_NONE);
+    OpenFonts();
+    LoadSpriteTextures(r);
+    BuildPalette();
+    BuildBackgrounds(r);
+
+    Uint64 freq  = SDL_GetPerformanceFrequency();
+    Uint64 total = SDL_GetPerformanceCounter();
+    int failed = 0;
+    Project project;
+    project.arena = &projectArena;
+    std::string err;
+    SDL_Rect stage{STAGE_X, STAGE_Y, STAGE_W, STAGE_H};
+    for (const std::string& path : paths) {
+        ArenaReset(projectArena);
+        if (!LoadProject(path, project, err)) {
+            std::cerr << err << "\n";
+            failed++;
+            continue;
+        }
+        ShowProject(project);
+        SDL_Surface* out = frame;
+        if (full) {
+            MarkAllDirty();
+            Render(r);
+        } else {
+            DrawStage(r);
+            out = thumb;
+        }
+        SDL_RenderFlush(r);
+        if (out == thumb) SDL_BlitSurface(frame, &stage, thumb, nullptr);
+
+        std::string file = ThumbnailPath(dir, path);
+        if (IMG_SavePNG(out, file.c_str()) != 0) {
+            std::cerr << file << ": " << SDL_GetError() << "\n";
+            failed++;
+            continue;
+        }
+        std::cout << file << "\n";
+    }
+    double secs = (SDL_GetPerformanceCounter() - total) / (double)freq;
+    char buf[160];
+    SDL_snprintf(buf, sizeof(buf), "%d thumbnails, %d failed, %.3f s, label cache %llu hits %llu misses\n",
+                 (int)paths.size() - failed, failed, secs,
+                 (unsigned long long)labelCache.hits, (unsigned long long)labelCache.misses);
+    std::cout << buf;
+    PrintImportStats();
+
+    FreeRenderResources();
+    SDL_DestroyRenderer(r);
+    SDL_FreeSurface(thumb);
+    SDL_FreeSurface(frame);
+    return failed ? 1 : 0;
+}
+
+// ─── Main ─────────────────────────────────────────────────────────────────────
+int main(int argc, char** argv) {
+    bool headless = false;
+    bool full     = false;
+    std::string thumbDir;
+    std::vector<std::string> projects;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--turbo") turboMode = true;
+        if (arg == "--headless") headless = true;
+        if (arg == "--full") full = true;
+        if (arg[0] != '-') projects.push_back(arg);
+        if (arg == "--threads" && i + 1 < argc) threadCount = std::atoi(argv[++i]);
+        if (arg == "--thumbnails" && i + 1 < argc) thumbDir = argv[++i];
+        if (arg == "--bench-motion") {
+            BenchMotion(i + 1 < argc ? std::atoi(argv[i + 1]) : 100000);
+            return 0;
+        }
+        if (arg == "--check-optimizer")
+            return CheckOptimizer(i + 1 < argc ? std::atoi(argv[i + 1]) : 200000) ? 1 : 0;
+    }
+
+    if (headless) {
+        SDL_Init(0);
+        StartThreadPool(threadCount);
+        int rc = RunHeadless(projects);
+        StopThreadPool();
+        SDL_Quit();
+        return rc;
+    }
+
+    if (!thumbDir.empty()) {
+        SDL_Init(0);
+        IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+        TTF_Init();
+        int rc = RunThumbnails(thumbDir, projects, full);
+        TTF_Quit();
+        IMG_Quit();
+        SDL_Quit();
+        return rc;
+    }
+
+    SDL_Init(SDL_INIT_VIDEO);
+    StartThreadPool(threadCount);
+    IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+    TTF_Init();
+
+    SDL_Window* window = SDL_CreateWindow("Scratch Clone - SDL2",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        WINDOW_W, WINDOW_H, SDL_WINDOW_SHOWN);
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1,
+        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
-    spriteTexture = IMG_LoadTexture(renderer, "sprite.jpg");
-    if (!spriteTexture) spriteTexture = IMG_LoadTexture(renderer, "sprite.png");
+    OpenFonts();
+    LoadSpriteTextures(renderer);
+
+    // The first project on the command line opens in the editor; Ctrl+S
+    // saves the binary format next to it (or to project.scb)
+    std::string savePath = "project.scb";
+    if (!projects.empty()) {
+        Project project;
+        std::string err;
+        if (LoadProject(projects[0], project, err)) OpenProject(project);
+        else std::cerr << err << "\n";
+        savePath = projects[0];
+        size_t dot = savePath.find_last_of('.');
+        if (dot != std::string::npos && savePath.find_first_of("/\\", dot) == std::string::npos)
+            savePath.resize(dot);
+        savePath += ".scb";
+    }
+    if (spriteList.count == 0) NewSprite(STAGE_W / 2.0f, STAGE_H / 2.0f, true, 0, {});
     BuildPalette();
+    BuildBackgrounds(renderer);
+    StartSimulation();
 
     bool running = true;
     SDL_Event e;
 
     while (running) {
-        while (SDL_PollEvent(&e)) {
+        // Block until input or the next step deadline, then drain the queue
+        if (SDL_WaitEventTimeout(&e, NextWakeTimeout())) do {
             if (e.type == SDL_QUIT) { running = false; break; }
+            if (e.type == sim.wakeEvent) continue;   // picked up by ConsumeSimulation
+
+            if (e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET ||
+                (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)) {
+                InvalidateBackgrounds();
+                MarkAllDirty();
+                continue;
+            }
+
+            if (e.type == SDL_MOUSEWHEEL) {
+                int mx, my;
+                SDL_GetMouseState(&mx, &my);
+                SDL_Point mp{mx, my};
+                if (SDL_PointInRect(&mp, &SPRITE_LIST_RECT)) ScrollSpriteList(spriteListFirst - e.wheel.y * 3);
+                if (SDL_PointInRect(&mp, &SCRIPTS_BODY_RECT)) {
+                    if (SDL_GetModState() & (KMOD_CTRL | KMOD_GUI)) ZoomWorkspace(view.zoomLevel + e.wheel.y, my);
+                    else ScrollWorkspace(view.scroll - e.wheel.y * SCROLL_STEP);
+                }
+                continue;
+            }
+
+            if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                damage.present = true;
+                continue;
+            }
 
             if (e.type == SDL_TEXTINPUT && editingValue) {
                 for (char ch : std::string(e.text.text)) {
                     if (std::isdigit(ch)) inputBuffer += ch;
                     else if (ch == '-' && inputBuffer.empty()) inputBuffer += ch;
                 }
+                MarkBlockDirty(editingBlock);
+                continue;
+            }
+
+            if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_s &&
+                (e.key.keysym.mod & (KMOD_CTRL | KMOD_GUI))) {
+                std::string err;
+                if (SaveProjectBinary(savePath, EditorProject(), err)) std::cout << "Saved " << savePath << "\n";
+                else std::cerr << err << "\n";
                 continue;
             }
 
             if (e.type == SDL_KEYDOWN && editingValue) {
+                MarkBlockDirty(editingBlock);
                 if (e.key.keysym.sym == SDLK_RETURN || e.key.keysym.sym == SDLK_KP_ENTER) {
-                    if (editingIdx >= 0 && editingIdx < (int)workspace.size()) {
+                    if (editingBlock != NO_BLOCK) {
+                        Block& eb = BlockAt(editingBlock);
                         try {
-                            if (inputBuffer == "-" || inputBuffer.empty()) workspace[editingIdx].steps = 0;
-                            else workspace[editingIdx].steps = std::stoi(inputBuffer); 
-                        } catch (...) { workspace[editingIdx].steps = 0; }
+                            if (inputBuffer == "-" || inputBuffer.empty()) eb.steps = 0;
+                            else eb.steps = std::stoi(inputBuffer); 
+                        } catch (...) { eb.steps = 0; }
+                        SendWorkspace();
                     }
                     editingValue = false;
                     SDL_StopTextInput();
@@ -501,39 +3811,72 @@ int main(int argc, char** argv) {
 
                 SDL_Rect goBtn{STAGE_X + 10, STAGE_Y + STAGE_H + 50, 90, 36};
                 if (SDL_PointInRect(&mp, &goBtn)) {
-                    if (!scriptRunning) StartScript();
+                    if (!scriptRunning) PostCommand({CMD_START});
                     continue;
                 }
 
                 SDL_Rect stopBtn{STAGE_X + 110, STAGE_Y + STAGE_H + 50, 90, 36};
                 if (SDL_PointInRect(&mp, &stopBtn)) {
-                    scriptRunning = false;
+                    PostCommand({CMD_STOP});
+                    continue;
+                }
+
+                SDL_Rect turboBtn{STAGE_X + 210, STAGE_Y + STAGE_H + 50, 90, 36};
+                if (SDL_PointInRect(&mp, &turboBtn)) {
+                    SimCommand c{CMD_SET_TURBO};
+                    c.flag = !shown.turbo;
+                    PostCommand(std::move(c));
+                    continue;
+                }
+
+                if (SDL_PointInRect(&mp, &ADD_SPRITE_BTN) || SDL_PointInRect(&mp, &DUP_SPRITE_BTN)) {
+                    if (mp.x >= ADD_SPRITE_BTN.x) {
+                        NewSprite(STAGE_W / 2.0f, STAGE_H / 2.0f, true, 0, {});
+                        SelectSprite(spriteList.count - 1);
+                    } else {
+                        DuplicateSprite(selectedSprite, 100);
+                    }
+                    ScrollSpriteList(spriteList.count);
+                    MarkDirty(SPRITE_LIST_RECT);
+                    continue;
+                }
+
+                if (SDL_PointInRect(&mp, &SPRITE_LIST_RECT)) {
+                    int row = spriteListFirst + (my - SPRITE_LIST_RECT.y) / SPRITE_ROW_H;
+                    if (row < spriteList.count) SelectSprite(row);
                     continue;
                 }
 
+                // Only the block under the cursor can be hit; blocks are tested in view units
                 bool clickedBadge = false;
-                for (int i = 0; i < (int)workspace.size(); i++) {
-                    Block& b = workspace[i];
-                    if (b.type != CHANGE_X && b.type != CHANGE_Y && b.type != SET_X && b.type != SET_Y) continue;
-                    int px2 = b.rect.x + b.rect.w - 46 - 8;
-                    int py2 = b.rect.y + (b.rect.h - 22) / 2;
+                SDL_Rect    hitRect;
+                SDL_Point   vp  = ScreenToView(mx, my);
+                BlockHandle hit = SDL_PointInRect(&mp, &SCRIPTS_BODY_RECT) ? WorkspaceBlockAtY(vp.y) : NO_BLOCK;
+                if (hit != NO_BLOCK && (!WorkspaceRect(hit, hitRect) || !SDL_PointInRect(&vp, &hitRect)))
+                    hit = NO_BLOCK;
+                if (hit != NO_BLOCK && HasValue(BlockAt(hit).type)) {
+                    int px2 = hitRect.x + hitRect.w - 46 - 8;
+                    int py2 = hitRect.y + (hitRect.h - 22) / 2;
                     SDL_Rect pill{px2, py2, 46, 22};
-                    if (SDL_PointInRect(&mp, &pill)) {
+                    if (SDL_PointInRect(&vp, &pill)) {
                         editingValue = true;
-                        editingIdx   = i;
-                        inputBuffer  = std::to_string(b.steps);
+                        editingBlock = hit;
+                        inputBuffer  = std::to_string(BlockAt(hit).steps);
                         SDL_StartTextInput();
+                        MarkBlockDirty(hit);
                         clickedBadge = true;
-                        break;
                     }
                 }
 
                 if (!clickedBadge && editingValue) {
-                    if (editingIdx >= 0 && editingIdx < (int)workspace.size()) {
+                    MarkBlockDirty(editingBlock);
+                    if (editingBlock != NO_BLOCK) {
+                        Block& eb = BlockAt(editingBlock);
                         try {
-                            if (inputBuffer == "-" || inputBuffer.empty()) workspace[editingIdx].steps = 0;
-                            else workspace[editingIdx].steps = std::stoi(inputBuffer); 
-                        } catch (...) { workspace[editingIdx].steps = 0; }
+                            if (inputBuffer == "-" || inputBuffer.empty()) eb.steps = 0;
+                            else eb.steps = std::stoi(inputBuffer); 
+                        } catch (...) { eb.steps = 0; }
+                        SendWorkspace();
                     }
                     editingValue = false;
                     SDL_StopTextInput();
@@ -549,31 +3892,30 @@ int main(int argc, char** argv) {
                         dragBlock       = b;
                         dragOffX        = mx - b.rect.x;
                         dragOffY        = my - b.rect.y;
+                        damage.present  = true;
                         break;
                     }
                 }
 
                 // Drag from Workspace
-                if (!dragging) {
-                    for (int i = (int)workspace.size()-1; i >= 0; i--) {
-                        if (SDL_PointInRect(&mp, &workspace[i].rect)) {
-                            dragging         = true;
-                            dragFromPalette  = false;
-                            dragWorkspaceIdx = i;
-                            dragBlock        = workspace[i];
-                            dragOffX         = mx - workspace[i].rect.x;
-                            dragOffY         = my - workspace[i].rect.y;
-                            workspace.erase(workspace.begin() + i);
-                            LayoutWorkspace();
-                            break;
-                        }
-                    }
+                if (!dragging && hit != NO_BLOCK) {
+                    dragging        = true;
+                    dragFromPalette = false;
+                    dragNode        = hit;
+                    dragBlock       = BlockAt(hit);
+                    dragOffX        = vp.x - hitRect.x;   // the ghost is drawn unzoomed
+                    dragOffY        = vp.y - hitRect.y;
+                    dragBlock.rect  = {mx - dragOffX, my - dragOffY, hitRect.w, hitRect.h};
+                    WorkspaceDetach(hit);
+                    SendWorkspace();
+                    MarkDirty({SCRIPTS_X, 0, SCRIPTS_W, WINDOW_H});
                 }
             }
 
             if (e.type == SDL_MOUSEMOTION && dragging) {
                 dragBlock.rect.x = e.motion.x - dragOffX;
                 dragBlock.rect.y = e.motion.y - dragOffY;
+                damage.present   = true;
             }
 
             if (e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT && dragging) {
@@ -582,30 +3924,34 @@ int main(int argc, char** argv) {
                 SDL_Rect wsRect{SCRIPTS_X, 0, SCRIPTS_W, WINDOW_H};
 
                 if (SDL_PointInRect(&pt, &wsRect)) {
-                    Block nb = dragBlock;
-                    int insertIdx = (int)workspace.size();
-                    for (int i = 0; i < (int)workspace.size(); i++) {
-                        if (my < workspace[i].rect.y + workspace[i].rect.h / 2) {
-                            insertIdx = i;
-                            break;
-                        }
-                    }
-                    workspace.insert(workspace.begin() + insertIdx, nb);
+                    // Before the block whose upper half is under the cursor; the
+                    // header drops above the top visible block
+                    SDL_Rect    rc;
+                    int         vy     = ScreenToView(mx, std::max(my, WORKSPACE_TOP)).y;
+                    BlockHandle before = WorkspaceBlockAtY(vy);
+                    if (before != NO_BLOCK && WorkspaceRect(before, rc) && vy >= rc.y + rc.h / 2)
+                        before = NextBlock(before);
+                    // A workspace block keeps its node; a palette block gets one
+                    if (dragNode == NO_BLOCK) dragNode = NewBlockNode(dragBlock);
+                    WorkspaceInsert(before, dragNode);
+                } else if (dragNode != NO_BLOCK) {
+                    FreeBlockNode(dragNode);
                 }
-                dragging         = false;
-                dragWorkspaceIdx = -1;
-                LayoutWorkspace();
+                dragging = false;
+                dragNode = NO_BLOCK;
+                ScrollWorkspace(view.scroll);
+                SendWorkspace();
+                MarkDirty({SCRIPTS_X, 0, SCRIPTS_W, WINDOW_H});
             }
-        }
+        } while (SDL_PollEvent(&e));
 
-        UpdateScript();
+        ConsumeSimulation();
         Render(renderer);
-        SDL_Delay(16);
     }
 
-    if (spriteTexture) SDL_DestroyTexture(spriteTexture);
-    if (font)          TTF_CloseFont(font);
-    if (fontSmall)     TTF_CloseFont(fontSmall);
+    StopSimulation();
+    StopThreadPool();
+    FreeRenderResources();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     TTF_Quit();